@@ -35,13 +35,12 @@ Image::~Image()
     free(_pixmap);
 }
 
-void Image::WriteTga(char *outfile, bool scale_color)
+bool Image::WriteTga(char *outfile, bool scale_color)
 {
     FILE *fp = fopen(outfile, "w");
     if (fp == NULL)
     {
-        perror("ERROR: Image::WriteTga() failed to open file for writing!\n");
-        exit(EXIT_FAILURE);
+        return false;
     }
     
     // write 24-bit uncompressed targa header
@@ -101,7 +100,49 @@ void Image::WriteTga(char *outfile, bool scale_color)
         }
     }
 
+    bool written = !ferror(fp);
+    return fclose(fp) == 0 && written;
+}
+
+bool Image::ReadTga(char *infile)
+{
+    unsigned char header[18];
+    FILE *fp = fopen(infile, "rb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    // only the layout WriteTga produces is understood: type 2, 24-bit, no id field
+    if (fread(header, 1, 18, fp) != 18 || header[0] != 0 || header[2] != 2 || header[16] != 24 ||
+        (header[12] | (header[13] << 8)) != _width || (header[14] | (header[15] << 8)) != _height)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    _max = 1.0;
+
+    // raw pixel data in groups of 3 bytes (BGR order), same walk as WriteTga
+    for (int y = 0; y < _height; y++)
+    {
+        for (int x = 0; x < _width; x++)
+        {
+            unsigned char bgr[3];
+            if (fread(bgr, 1, 3, fp) != 3)
+            {
+                fclose(fp);
+                return false;
+            }
+            _pixmap[x][y].r = bgr[2] / 255.0;
+            _pixmap[x][y].g = bgr[1] / 255.0;
+            _pixmap[x][y].b = bgr[0] / 255.0;
+            _pixmap[x][y].f = 0.0;
+        }
+    }
+
     fclose(fp);
+    return true;
 }
 
 void Image::GenTestPattern()
@@ -44,8 +44,13 @@ public:
     ~Image();
 
     // if scale_color is true, the output targa will have its color space scaled
-    // to the global max, otherwise it will be clamped at 1.0
-    void WriteTga(char *outfile, bool scale_color = true);
+    // to the global max, otherwise it will be clamped at 1.0; returns false if
+    // the file can't be written, with errno saying why
+    bool WriteTga(char *outfile, bool scale_color = true);
+
+    // reads a 24-bit uncompressed targa of the same size as this image,
+    // colors come back in 0.0 -> 1.0; returns false if the file doesn't fit
+    bool ReadTga(char *infile);
 
     void GenTestPattern();
 
@@ -0,0 +1,90 @@
+#include "antialias.h"
+#include "scene.h"
+#include "gbuffer.h"
+#include "objs.h"
+#include "random.h"
+#include "sampler.h"
+#include "options.h"
+#include "Image.h"
+#include <cmath>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+/* Largest channel difference between two rendered pixels, 0 -> 1 */
+static float contrast(color_t a, color_t b) {
+	return max(fabs(a.r - b.r), max(fabs(a.g - b.g), fabs(a.b - b.b))) / 255;
+}
+
+/* Flag both pixels when they differ enough to show a jagged edge */
+static void compare(Scene *scene, Options *options, Image *img, vector<char> *refine, int i, int j, int ni, int nj) {
+	int height = options->height;
+
+	if (scene->gbuffer->object[i * height + j] != scene->gbuffer->object[ni * height + nj] ||
+		contrast(img->pixel(i, j), img->pixel(ni, nj)) > options->aaThreshold) {
+		(*refine)[i * height + j] = true;
+		(*refine)[ni * height + nj] = true;
+	}
+}
+
+/* Average of n x n samples: a grid jittered inside its cells with the random sampler, */
+/* otherwise the first n x n points of the pixel's sequence, which stratify on their own */
+static Pigment supersample(Scene *scene, Options *options, int i, int j) {
+	int n = options->aa;
+	Pigment sum = Pigment(0, 0, 0);
+	Random jitter;
+
+	jitter.Seed(i, j, -1);
+
+	for (int sx = 0; sx < n; sx++) {
+		for (int sy = 0; sy < n; sy++) {
+			double dx = (sx + jitter.Uniform()) / n, dy = (sy + jitter.Uniform()) / n;
+
+			if (options->sampler != SAMPLER_RANDOM) {
+				PixelSampler sampler = PixelSampler(options->sampler, i, j, sx * n + sy);
+				dx = sampler.Get(0);
+				dy = sampler.Get(1);
+			}
+
+			Ray ray = Ray(i, j, dx, dy, options->width, options->height, &scene->camera);
+			float distance = 10000;
+			raysTraced++;
+
+			Geometry *hit = closestHit(&scene->allGeometry, i, j, &ray, &distance);
+
+			if (hit)
+				sum += scene->ShadePixel(i, j, &ray, hit, distance, options->samples, options->maxDepth);
+		}
+	}
+
+	sum *= 1.0 / (n * n);
+	return sum;
+}
+
+int refineEdges(Scene *scene, Options *options, Image *img) {
+	int width = options->width, height = options->height, refined = 0;
+	vector<char> refine(width * height, false);
+	color_t color;
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			if (i + 1 < width)
+				compare(scene, options, img, &refine, i, j, i + 1, j);
+			if (j + 1 < height)
+				compare(scene, options, img, &refine, i, j, i, j + 1);
+		}
+	}
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			if (!refine[i * height + j])
+				continue;
+
+			supersample(scene, options, i, j).SetColorT(&color);
+			img->pixel(i, j, color);
+			refined++;
+		}
+	}
+
+	return refined;
+}
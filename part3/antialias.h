@@ -0,0 +1,11 @@
+#pragma once
+#include "scene.h"
+#include "options.h"
+#include "Image.h"
+using namespace std;
+
+/* Adaptive anti-aliasing, run after the one ray per pixel render in img. Pixels whose */
+/* color differs from a neighbour's by more than options->aaThreshold, or whose primary */
+/* hit is a different object, are traced again with an aa x aa grid of jittered samples. */
+/* scene->gbuffer must hold the primary hits img was rendered from. Returns pixels refined */
+int refineEdges(Scene *scene, Options *options, Image *img);
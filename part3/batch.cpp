@@ -0,0 +1,171 @@
+#include "batch.h"
+#include "render.h"
+#include "parse.h"
+#include "scene.h"
+#include "options.h"
+#include "timer.h"
+#include "Image.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <future>
+#include <string>
+#include <vector>
+using namespace std;
+
+/* One manifest line, and the scene and image of its render while it's in flight */
+class BatchJob {
+public:
+	BatchJob();
+	int line;
+	Options options;
+	Scene *scene;
+	Image *img;
+};
+
+BatchJob::BatchJob() {
+	line = 0;
+	scene = NULL;
+	img = NULL;
+}
+
+/* Fill in job from the words of its manifest line after the command line's flags. Returns */
+/* 1, with the error printed, on a bad line or a job batch mode can't run */
+static int parseJob(Options *options, vector<string> *words, BatchJob *job) {
+	vector<string> arguments;
+	vector<char *> argv;
+
+	if (words->size() < 4 || !wholeNumber(&words->at(0)) || !wholeNumber(&words->at(1))) {
+		cout << "Error. " << options->batch << " line " << job->line << ": expected width height scene.pov output.tga [options]" << endl;
+		return 1;
+	}
+
+	arguments.push_back("raytrace");
+	arguments.insert(arguments.end(), words->begin(), words->begin() + 3);
+	arguments.push_back("--output");
+	arguments.push_back(words->at(3));
+
+	/* Everything on the command line but --batch itself */
+	for (int a = 0; a < options->arguments.size(); a++) {
+		if (options->arguments[a] == "--batch")
+			a++;
+		else
+			arguments.push_back(options->arguments[a]);
+	}
+	arguments.insert(arguments.end(), words->begin() + 4, words->end());
+
+	for (int a = 0; a < arguments.size(); a++)
+		argv.push_back((char *) arguments[a].c_str());
+
+	if (parseOptions(argv.size(), &argv[0], &job->options)) {
+		cout << "Error. In " << options->batch << " line " << job->line << "." << endl;
+		return 1;
+	}
+
+	/* One --scene-image path for every job would have each job overwrite the one before's */
+	if (!plainRender(&job->options) || job->options.sceneImage.size()) {
+		cout << "Error. " << options->batch << " line " << job->line << ": batch jobs are default renders written to their output." << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Every job in the manifest, or 1 if it can't be read or any line is bad */
+static int readManifest(Options *options, vector<BatchJob> *jobs) {
+	ifstream manifest(options->batch.c_str());
+	string text;
+	int line = 0, failed = 0;
+
+	if (!manifest.is_open()) {
+		cout << "Error. Can't open batch manifest " << options->batch << "." << endl;
+		return 1;
+	}
+
+	while (getline(manifest, text)) {
+		istringstream fields(text);
+		vector<string> words;
+		string word;
+
+		line++;
+		while (fields >> word)
+			words.push_back(word);
+
+		if (!words.size() || words[0][0] == '#')
+			continue;
+
+		jobs->push_back(BatchJob());
+		jobs->back().line = line;
+		failed |= parseJob(options, &words, &jobs->back());
+	}
+
+	return failed;
+}
+
+/* Parse the job's scene while the job before renders */
+static int loadJob(BatchJob *job) {
+	job->scene = new Scene();
+
+	if (fileOps(&job->options, job->scene)) {
+		delete job->scene;
+		job->scene = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Write the job's image while the job after renders */
+static int writeJob(BatchJob *job) {
+	int failed = writeRender(&job->options, job->img);
+
+	delete job->img;
+	job->img = NULL;
+	return failed;
+}
+
+int runBatch(Options *options) {
+	vector<BatchJob> jobs;
+	future<int> loading, writing;
+	int failed = 0;
+	Timer timer;
+
+	if (readManifest(options, &jobs))
+		return 1;
+
+	/* jobs doesn't change size from here on, so the loader and writer can hold pointers into it */
+	if (jobs.size())
+		loading = async(launch::async, loadJob, &jobs[0]);
+
+	for (int j = 0; j < jobs.size(); j++) {
+		BatchJob *job = &jobs[j];
+		bool loaded = !loading.get();
+
+		if (j + 1 < jobs.size())
+			loading = async(launch::async, loadJob, &jobs[j + 1]);
+
+		if (!loaded) {
+			cout << "Error. " << options->batch << " line " << job->line << ": can't read " << job->options.fileName << ", skipping it." << endl;
+			failed++;
+			continue;
+		}
+
+		job->img = new Image(job->options.width, job->options.height);
+		renderTiles(job->scene, &job->options, job->img, NULL, NULL);
+
+		delete job->scene;
+		job->scene = NULL;
+
+		if (writing.valid())
+			failed += writing.get();
+		writing = async(launch::async, writeJob, job);
+	}
+
+	if (writing.valid())
+		failed += writing.get();
+
+	printf("Batch: %d jobs in %.2fs, %d failed.\n", (int) jobs.size(), timer.Seconds(), failed);
+	return failed ? 1 : 0;
+}
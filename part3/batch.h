@@ -0,0 +1,11 @@
+#pragma once
+#include "options.h"
+using namespace std;
+
+/* --batch: render every job in the manifest in one process. Each line is */
+/*   width height scene.pov output.tga [options] */
+/* with blank lines and lines starting with # skipped; the options on the command line apply */
+/* to every job, and a job's own options come after them. Jobs render one at a time on all */
+/* the threads, while the next job's scene is parsed and the last one's image is written. */
+/* Returns 1 if the manifest is bad or any job failed */
+int runBatch(Options *options);
@@ -0,0 +1,103 @@
+#include "budget.h"
+#include "options.h"
+#include "timer.h"
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+/* Aim to finish this far inside the budget, for the tiles still running when it's judged */
+static const double HEADROOM = 0.9;
+
+/* Weight of the latest tile in the running cost */
+static const double RECENT_WEIGHT = 0.1;
+
+QualityLevel::QualityLevel(int samples, int maxDepth, int block) {
+	this->samples = samples;
+	this->maxDepth = maxDepth;
+	this->block = block;
+}
+
+/* Relative cost of a pixel: rays for every sample and bounce, shared over the block */
+static double work(QualityLevel *level) {
+	return (double) level->samples * (level->maxDepth + 1) / (level->block * level->block);
+}
+
+/* Halve the samples down to one, then the reflection depth down to none, then trace */
+/* one pixel in 2x2, 4x4 and 8x8 */
+QualityControl::QualityControl(Options *options, double weight, int threads) {
+	int samples = options->samples, depth = options->maxDepth;
+
+	levels.push_back(QualityLevel(samples, depth, 1));
+	while (samples > 1) {
+		samples /= 2;
+		levels.push_back(QualityLevel(samples, depth, 1));
+	}
+	while (depth > 0) {
+		depth /= 2;
+		levels.push_back(QualityLevel(1, depth, 1));
+	}
+	for (int block = 2; block <= 8; block *= 2)
+		levels.push_back(QualityLevel(1, 0, block));
+
+	tiles.assign(levels.size(), 0);
+	ms.assign(levels.size(), 0);
+	measured.assign(levels.size(), 0);
+	remaining = weight;
+	recent = 0;
+	current = 0;
+	this->threads = threads;
+	budgetMs = options->timeBudget * 1000;
+}
+
+/* Cost of a unit of weight at level over one at from: measured once both have been used, */
+/* otherwise guessed from work(). Whether fewer bounces save anything depends on how much */
+/* of the scene reflects, so the guess is only trusted until the level has been tried */
+double QualityControl::Ratio(int level, int from) {
+	if (measured[level] && measured[from])
+		return (ms[level] / measured[level]) / (ms[from] / measured[from]);
+
+	return work(&levels[level]) / work(&levels[from]);
+}
+
+/* Level for a tile about to start: one step down when the weight left won't fit at the */
+/* current level, one step up when it would fit there with room to spare */
+int QualityControl::Choose(double weight) {
+	lock_guard<mutex> guard(lock);
+	double left = (budgetMs - timer.Milliseconds()) * HEADROOM;
+
+	if (recent && current < levels.size() - 1 && remaining * recent / threads > left) {
+		recent *= Ratio(current + 1, current);
+		current++;
+	}
+	else if (recent && current > 0 && remaining * recent * Ratio(current - 1, current) / threads <= left * HEADROOM) {
+		recent *= Ratio(current - 1, current);
+		current--;
+	}
+
+	remaining -= weight;
+	tiles[current]++;
+	return current;
+}
+
+void QualityControl::Done(int level, double weight, double ms) {
+	lock_guard<mutex> guard(lock);
+	double cost = ms / weight;
+
+	this->ms[level] += ms;
+	measured[level] += weight;
+
+	/* Tiles still finishing at a level we've since left don't move the running cost */
+	if (level == current)
+		recent = recent ? recent + RECENT_WEIGHT * (cost - recent) : cost;
+}
+
+void QualityControl::Report() {
+	printf("Time budget: %.2fs of %.2fs used. Quality levels:\n", timer.Seconds(), budgetMs / 1000);
+
+	for (int l = 0; l < levels.size(); l++)
+		if (tiles[l])
+			printf("  %s%d spp, depth %d, 1 ray per %dx%d: %d tiles\n", l ? "" : "full, ", levels[l].samples, levels[l].maxDepth,
+				levels[l].block, levels[l].block, tiles[l]);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "options.h"
+#include "timer.h"
+#include <mutex>
+#include <vector>
+using namespace std;
+
+/* One step down the quality ladder: samples per pixel, reflection depth, and the side of */
+/* the square of pixels that shares one traced ray */
+class QualityLevel {
+public:
+	QualityLevel(int samples, int maxDepth, int block);
+	int samples, maxDepth, block;
+};
+
+/* --time-budget for Whitted renders. Each tile has a weight, its expected share of the */
+/* work, from a sparse probe before rendering. Before each tile, checks whether the weight */
+/* not yet started would fit what's left of the budget at the current level, from a running */
+/* cost per unit of weight, and steps down a level if not, or back up if well ahead. The */
+/* last level (one ray per 8x8 block, no reflections) is the floor that always gets the */
+/* frame done */
+class QualityControl {
+public:
+	QualityControl(Options *options, double weight, int threads);
+	int Choose(double weight);
+	void Done(int level, double weight, double ms);
+	double Ratio(int level, int from);
+	void Report();
+	vector<QualityLevel> levels;
+	vector<double> ms, measured; /* per level, time spent and weight finished */
+	vector<int> tiles; /* per level, tiles rendered */
+	int current; /* level new tiles get */
+	double recent; /* running ms per unit of weight at the current level, 0 until a tile is done */
+	double remaining; /* weight of the tiles not yet started */
+	int threads;
+	double budgetMs;
+	Timer timer;
+	mutex lock;
+};
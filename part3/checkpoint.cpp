@@ -0,0 +1,229 @@
+#include "checkpoint.h"
+#include "render.h"
+#include "objs.h"
+#include "options.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+static const char magic[4] = {'R', 'T', 'C', 'P'};
+static const uint32_t VERSION = 1;
+
+/* Arguments left out of the key so a resumed run may differ in them: ones that can't change */
+/* a pixel, and the limits on how long a path render goes on refining */
+static const char *switches[] = {"--resume", "--perf", "--record"};
+static const char *settings[] = {"--checkpoint", "--checkpoint-interval", "--threads", "--output", "--golden",
+	"--baseline", "--max-error", "--min-psnr", "--max-slowdown", "--profile", "--time-budget", "--path-spp"};
+
+/* FNV-1a over raw bytes */
+static void hashBytes(uint64_t *hash, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char *) data;
+
+	for (size_t b = 0; b < size; b++) {
+		*hash ^= bytes[b];
+		*hash *= 1099511628211ULL;
+	}
+}
+
+static bool listed(const char **names, int count, const string &argument) {
+	for (int n = 0; n < count; n++)
+		if (argument == names[n])
+			return true;
+	return false;
+}
+
+static uint64_t checkpointKey(Options *options, string *text) {
+	uint64_t hash = 14695981039346656037ULL;
+	vector<string> *arguments = &options->arguments;
+
+	hashBytes(&hash, text->data(), text->size());
+
+	for (int a = 0; a < arguments->size(); a++) {
+		if (listed(switches, sizeof(switches) / sizeof(*switches), arguments->at(a)))
+			continue;
+		if (listed(settings, sizeof(settings) / sizeof(*settings), arguments->at(a))) {
+			a++;
+			continue;
+		}
+
+		hashBytes(&hash, arguments->at(a).c_str(), arguments->at(a).size() + 1);
+	}
+
+	return hash;
+}
+
+Checkpoint::Checkpoint() {
+	fileName = "";
+	interval = 0;
+	key = 0;
+	written = 0;
+	stopping = false;
+}
+
+Checkpoint::~Checkpoint() {
+	if (writer.joinable()) {
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		writer.join();
+	}
+}
+
+/* Work out the key and, with --resume, read the renderer state back. A missing checkpoint */
+/* just means starting from the beginning; one from another render is an error, rather than */
+/* something to overwrite. Returns 1 on error */
+int Checkpoint::Open(Options *options) {
+	ifstream povray(options->fileName.c_str(), ios::binary);
+	stringstream text;
+	string contents;
+	char header[4];
+	uint32_t version;
+	uint64_t stored;
+	FILE *in;
+
+	fileName = options->checkpoint;
+	interval = options->checkpointInterval;
+
+	text << povray.rdbuf();
+	contents = text.str();
+	key = checkpointKey(options, &contents);
+
+	if (!options->resume)
+		return 0;
+
+	if (!(in = fopen(fileName.c_str(), "rb"))) {
+		cout << "No checkpoint at " << fileName << ", starting from the beginning." << endl;
+		return 0;
+	}
+
+	if (fread(header, 1, 4, in) != 4 || memcmp(header, magic, 4) || fread(&version, sizeof(version), 1, in) != 1 ||
+		version != VERSION || fread(&stored, sizeof(stored), 1, in) != 1 || stored != key) {
+		cout << "Error. Checkpoint " << fileName << " is from a different scene or settings." << endl;
+		fclose(in);
+		return 1;
+	}
+
+	char buffer[1 << 16];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), in)) > 0)
+		resumed.append(buffer, got);
+
+	fclose(in);
+	return 0;
+}
+
+/* Snapshot every interval until Finish; snapshot runs on the writer thread */
+void Checkpoint::Start(function<void(string *)> snapshot) {
+	this->snapshot = snapshot;
+
+	writer = thread([this]() {
+		unique_lock<mutex> guard(lock);
+
+		while (!wake.wait_for(guard, chrono::duration<double>(interval), [this]() { return stopping; })) {
+			guard.unlock();
+			Write();
+			guard.lock();
+		}
+	});
+}
+
+void Checkpoint::Write() {
+	string state, temporary = fileName + ".tmp";
+	FILE *out;
+	bool ok;
+
+	snapshot(&state);
+
+	if (!(out = fopen(temporary.c_str(), "wb"))) {
+		cout << "Error writing checkpoint " << fileName << ", continuing without it." << endl;
+		return;
+	}
+
+	ok = fwrite(magic, 1, 4, out) == 4 && fwrite(&VERSION, sizeof(VERSION), 1, out) == 1 &&
+		fwrite(&key, sizeof(key), 1, out) == 1 && fwrite(state.data(), 1, state.size(), out) == state.size();
+	ok = !fclose(out) && ok;
+
+	if (!ok || rename(temporary.c_str(), fileName.c_str())) {
+		cout << "Error writing checkpoint " << fileName << ", continuing without it." << endl;
+		unlink(temporary.c_str());
+		return;
+	}
+
+	written++;
+}
+
+/* Stop the writer. A complete render has no use for its checkpoint; an unfinished one */
+/* (stopped by --time-budget) leaves its final state for a later --resume to refine */
+void Checkpoint::Finish(bool complete) {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	if (writer.joinable())
+		writer.join();
+
+	if (complete)
+		unlink(fileName.c_str());
+	else
+		Write();
+}
+
+void appendTiles(string *state, vector<Tile> *tiles, vector<Pigment> *colors, int height) {
+	int32_t count = tiles->size();
+
+	state->append((const char *) &count, sizeof(count));
+
+	for (int t = 0; t < tiles->size(); t++) {
+		Tile *tile = &tiles->at(t);
+		int32_t corners[4] = {tile->x0, tile->y0, tile->x1, tile->y1};
+
+		state->append((const char *) corners, sizeof(corners));
+		for (int i = tile->x0; i < tile->x1; i++)
+			state->append((const char *) &colors->at(i * height + tile->y0), (tile->y1 - tile->y0) * sizeof(Pigment));
+	}
+}
+
+bool readTiles(string *state, vector<Tile> *tiles, vector<Pigment> *colors, int height) {
+	const char *next = state->data(), *end = next + state->size();
+	int width = colors->size() / height;
+	int32_t count;
+
+	if (end - next < sizeof(count))
+		return false;
+	memcpy(&count, next, sizeof(count));
+	next += sizeof(count);
+
+	for (int t = 0; t < count; t++) {
+		int32_t corners[4];
+
+		if (end - next < sizeof(corners))
+			return false;
+		memcpy(corners, next, sizeof(corners));
+		next += sizeof(corners);
+
+		Tile tile = Tile(corners[0], corners[1], corners[2], corners[3]);
+		size_t column = (tile.y1 - tile.y0) * sizeof(Pigment);
+
+		if (tile.x0 < 0 || tile.y0 < 0 || tile.x1 > width || tile.y1 > height || tile.x0 >= tile.x1 || tile.y0 >= tile.y1 ||
+			(end - next) / column < tile.x1 - tile.x0)
+			return false;
+
+		for (int i = tile.x0; i < tile.x1; i++, next += column)
+			memcpy(&colors->at(i * height + tile.y0), next, column);
+		tiles->push_back(tile);
+	}
+
+	return next == end;
+}
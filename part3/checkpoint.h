@@ -0,0 +1,42 @@
+#pragma once
+#include "objs.h"
+#include "options.h"
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/* --checkpoint: snapshots of a render in progress, so a pre-empted render can --resume. */
+/* A background thread asks the renderer for a snapshot every --checkpoint-interval seconds */
+/* and writes it (through a temp file and rename) while the render threads carry on. The */
+/* key covers the .pov text and every argument that can change a pixel, so a checkpoint is */
+/* never resumed into a different render */
+class Checkpoint {
+public:
+	Checkpoint();
+	~Checkpoint();
+	int Open(Options *options);
+	void Start(function<void(string *)> snapshot);
+	void Finish(bool complete);
+	void Write();
+	string fileName;
+	float interval;
+	uint64_t key;
+	string resumed; /* renderer state read by --resume, empty when starting fresh */
+	int written;
+	function<void(string *)> snapshot;
+	thread writer;
+	mutex lock;
+	condition_variable wake;
+	bool stopping;
+};
+
+/* Finished tiles for a Whitted checkpoint: each tile's corners then its pixels, column by column */
+void appendTiles(string *state, vector<class Tile> *tiles, vector<Pigment> *colors, int height);
+
+/* Read appendTiles' tiles back into tiles and colors; false if state is damaged */
+bool readTiles(string *state, vector<class Tile> *tiles, vector<Pigment> *colors, int height);
@@ -0,0 +1,100 @@
+#include "debug.h"
+#include "objs.h"
+#include "Image.h"
+#include "random.h"
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+RayNode::RayNode() {
+	type = "primary";
+	T = -1;
+	hit = NULL;
+}
+
+RayNode::RayNode(const char *type, Ray *ray) {
+	this->type = type;
+	this->ray = Ray(&ray->start, &ray->direction);
+	T = -1;
+	hit = NULL;
+}
+
+RayNode::~RayNode() {
+	for (int c = 0; c < children.size(); c++)
+		delete children[c];
+}
+
+/* Copy Blinn Phong terms right after hit->BlinnPhong, before the next bounce overwrites them */
+void RayNode::SetShading(Geometry *hit, float T, Pigment *ambient, Pigment *diffuse, Pigment *specular) {
+	this->hit = hit;
+	this->T = T;
+	this->ambient = *ambient;
+	this->diffuse = *diffuse;
+	this->specular = *specular;
+}
+
+static void printTriple(const char *name, float x, float y, float z) {
+	cout << "\"" << name << "\": [" << x << ", " << y << ", " << z << "]";
+}
+
+/* Print this node and its children as indented JSON */
+void RayNode::Print(int depth) {
+	string indent(depth * 2, ' ');
+
+	cout << indent << "{\"type\": \"" << type << "\", ";
+	printTriple("start", ray.start.x, ray.start.y, ray.start.z);
+	cout << ", ";
+	printTriple("direction", ray.direction.x, ray.direction.y, ray.direction.z);
+
+	if (!hit) {
+		cout << ", \"T\": null}";
+		return;
+	}
+
+	vector<Geometry *> *allGeometry = hit->allGeometry;
+	int index = find(allGeometry->begin(), allGeometry->end(), hit) - allGeometry->begin();
+
+	cout << ", \"T\": " << T << "," << endl;
+	cout << indent << " \"object\": \"" << hit->TypeName() << "\", \"index\": " << index << "," << endl;
+	cout << indent << " ";
+	printTriple("ambient", ambient.r, ambient.g, ambient.b);
+	cout << ", ";
+	printTriple("diffuse", diffuse.r, diffuse.g, diffuse.b);
+	cout << ", ";
+	printTriple("specular", specular.r, specular.g, specular.b);
+	cout << "," << endl << indent << " ";
+	printTriple("color", color.r, color.g, color.b);
+	cout << ", \"children\": [";
+
+	for (int c = 0; c < children.size(); c++) {
+		cout << (c ? "," : "") << endl;
+		children[c]->Print(depth + 1);
+	}
+
+	if (children.size())
+		cout << endl << indent << " ";
+	cout << "]}";
+}
+
+/* Instrumented version of the main pixel loop body, only run for requested pixels */
+void debugPixel(int i, int j, int width, int height, Camera *camera, vector<Geometry *> *allGeometry) {
+	float closest = 10000;
+	color_t color = {0, 0, 0, 0};
+	Ray ray = Ray(i, j, width, height, camera);
+	RayNode root = RayNode("primary", &ray);
+	Geometry *hitGeometry = closestHit(allGeometry, i, j, &ray, &closest);
+
+	if (hitGeometry) {
+		shadingRandom.Seed(i, j, 0); /* same choices as the first sample of the render */
+		hitGeometry->Reflect(i, j, closest, &ray, &root, hitGeometry->bounceLimits->maxDepth);
+		root.color.SetColorT(&color);
+	}
+
+	cout << "{\"pixel\": [" << i << ", " << j << "], ";
+	cout << "\"color\": [" << (int) color.r << ", " << (int) color.g << ", " << (int) color.b << "]," << endl;
+	cout << " \"tree\":" << endl;
+	root.Print(1);
+	cout << "}" << endl;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "objs.h"
+#include <vector>
+using namespace std;
+
+/* One ray in a debug pixel's ray tree, with the shading terms found where it landed */
+class RayNode {
+public:
+	RayNode();
+	RayNode(const char *type, Ray *ray);
+	~RayNode();
+	void SetShading(Geometry *hit, float T, Pigment *ambient, Pigment *diffuse, Pigment *specular);
+	void Print(int depth);
+	const char *type; /* "primary", "reflection" or "refraction" */
+	Ray ray;
+	float T; /* -1 when the ray missed everything */
+	Geometry *hit;
+	Pigment ambient, diffuse, specular, color;
+	vector<RayNode *> children;
+};
+
+/* Re-trace pixel (i, j) with a RayNode tree attached and print the tree as JSON */
+void debugPixel(int i, int j, int width, int height, Camera *camera, vector<Geometry *> *allGeometry);
@@ -0,0 +1,353 @@
+#include "deferred.h"
+#include "objs.h"
+#include "scene.h"
+#include "lights.h"
+#include "profile.h"
+#include "options.h"
+#include "render.h"
+#include "Image.h"
+#include <cmath>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+void HitBuffer::Clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+	nx.clear();
+	ny.clear();
+	nz.clear();
+	material.clear();
+	i.clear();
+	j.clear();
+	specular.clear();
+}
+
+/* record's onGeom and normal must already be set for this hit on geom */
+void HitBuffer::Add(Geometry *geom, HitRecord *record, int i, int j) {
+	x.push_back(record->onGeom.x);
+	y.push_back(record->onGeom.y);
+	z.push_back(record->onGeom.z);
+	nx.push_back(record->normal.x);
+	ny.push_back(record->normal.y);
+	nz.push_back(record->normal.z);
+	material.push_back(geom->material);
+	this->i.push_back(i);
+	this->j.push_back(j);
+	specular.push_back(geom->Specular());
+}
+
+int HitBuffer::Size() {
+	return x.size();
+}
+
+/* One material's hits copied out of the HitBuffer, plus per light scratch space */
+class ShadingBatch {
+public:
+	void Gather(HitBuffer *hits, int *order, int count);
+	int count;
+	vector<int> index; /* position in the HitBuffer */
+	vector<float> x, y, z, nx, ny, nz, vx, vy, vz; /* point, normal, direction to the camera */
+	vector<float> lx, ly, lz, distance, lambert; /* to the current light */
+	vector<char> specular, visible;
+	vector<float> r, g, b;
+};
+
+void ShadingBatch::Gather(HitBuffer *hits, int *order, int count) {
+	this->count = count;
+	index.assign(order, order + count);
+
+	x.resize(count);
+	y.resize(count);
+	z.resize(count);
+	nx.resize(count);
+	ny.resize(count);
+	nz.resize(count);
+	vx.resize(count);
+	vy.resize(count);
+	vz.resize(count);
+	lx.resize(count);
+	ly.resize(count);
+	lz.resize(count);
+	distance.resize(count);
+	lambert.resize(count);
+	specular.resize(count);
+	visible.resize(count);
+	r.resize(count);
+	g.resize(count);
+	b.resize(count);
+
+	for (int k = 0; k < count; k++) {
+		int h = order[k];
+		x[k] = hits->x[h];
+		y[k] = hits->y[h];
+		z[k] = hits->z[h];
+		nx[k] = hits->nx[h];
+		ny[k] = hits->ny[h];
+		nz[k] = hits->nz[h];
+		specular[k] = hits->specular[h];
+	}
+}
+
+/* Clear visible[] for the members with something between them and light. Geometry is the */
+/* outer loop, so each object is read once for the whole batch rather than once per feeler */
+static void shadowBatch(Scene *scene, HitBuffer *hits, ShadingBatch *batch, int *members, int count, Light *light) {
+	static thread_local vector<Ray> feelers;
+	static thread_local vector<int> open;
+
+	feelers.clear();
+	open.clear();
+
+	for (int e = 0; e < count; e++) {
+		int k = members[e];
+
+		if (!batch->visible[k])
+			continue;
+
+		Point start = Point(batch->x[k], batch->y[k], batch->z[k]);
+		Vector direction = Vector(batch->lx[k], batch->ly[k], batch->lz[k]);
+		feelers.push_back(Ray(&start, &direction));
+		open.push_back(k);
+	}
+	raysTraced += open.size();
+
+	ObjectCost *costs = profileCosts();
+
+	for (int o = 0; o < scene->allGeometry.size() && open.size(); o++) {
+		Geometry *other = scene->allGeometry[o];
+
+		for (int f = 0; f < open.size(); f++) {
+			int k = open[f], h = batch->index[k];
+			float dist;
+
+			if (costs) {
+				uint64_t start = profileClock();
+				dist = other->Intersect(hits->i[h], hits->j[h], &feelers[f]);
+				costs[o].intersectTicks += profileClock() - start;
+				costs[o].tested++;
+			}
+			else
+				dist = other->Intersect(hits->i[h], hits->j[h], &feelers[f]);
+
+			/* Blocked: drop it from the open list so later objects skip it */
+			if (dist > 0.001 && dist < batch->distance[k]) {
+				if (costs)
+					costs[o].occlusions++;
+
+				batch->visible[k] = false;
+				feelers[f] = feelers.back();
+				feelers.pop_back();
+				open[f--] = open.back();
+				open.pop_back();
+			}
+		}
+	}
+}
+
+/* Blinn Phong for a batch of hits sharing material m, light by light. Each step is a plain */
+/* loop over float arrays, in the same order of operations as Geometry::BlinnPhong so the */
+/* result matches the immediate path. Every hit asks the LightTree for its nearby lights, */
+/* so far lights cost nothing, and lights are taken in rank order, which is Query's order */
+/* for every hit */
+static void shadeBatch(Scene *scene, HitBuffer *hits, ShadingBatch *batch, Material *m) {
+	static thread_local vector<Light *> nearby, ranked;
+	static thread_local vector<int> visits, start, members;
+	LightTree *tree = &scene->lightTree;
+	float reflectScale = 1 - m->finish.reflect;
+	int n = batch->count, lights = tree->global.size() + tree->local.size();
+
+	for (int k = 0; k < n; k++) {
+		batch->r[k] = m->ambient.r * tree->ambient.r;
+		batch->g[k] = m->ambient.g * tree->ambient.g;
+		batch->b[k] = m->ambient.b * tree->ambient.b;
+	}
+
+	for (int k = 0; k < n; k++) {
+		float vx = scene->camera.center.x - batch->x[k], vy = scene->camera.center.y - batch->y[k], vz = scene->camera.center.z - batch->z[k];
+		float length = sqrt((double) vx * vx + (double) vy * vy + (double) vz * vz);
+
+		batch->vx[k] = vx / length;
+		batch->vy[k] = vy / length;
+		batch->vz[k] = vz / length;
+	}
+
+	/* Each hit's nearby lights as (rank, hit) pairs, then a counting sort by rank into */
+	/* members, so start[r] .. start[r + 1] are the hits light r reaches, in hit order */
+	ranked.resize(lights);
+	start.assign(lights + 1, 0);
+	visits.clear();
+	for (int k = 0; k < n; k++) {
+		Point point = Point(batch->x[k], batch->y[k], batch->z[k]);
+
+		nearby.clear();
+		tree->Query(&point, &nearby);
+		for (int l = 0; l < nearby.size(); l++) {
+			ranked[nearby[l]->rank] = nearby[l];
+			start[nearby[l]->rank + 1]++;
+			visits.push_back(nearby[l]->rank);
+			visits.push_back(k);
+		}
+	}
+
+	for (int r = 0; r < lights; r++)
+		start[r + 1] += start[r];
+	members.resize(start[lights]);
+	for (int v = 0; v < visits.size(); v += 2)
+		members[start[visits[v]]++] = visits[v + 1];
+	for (int r = lights; r > 0; r--)
+		start[r] = start[r - 1];
+	start[0] = 0;
+
+	for (int r = 0; r < lights; r++) {
+		Light *light = ranked[r];
+		int first = start[r], last = start[r + 1], any = 0;
+
+		for (int e = first; e < last; e++) {
+			int k = members[e];
+			float lx = light->center.x - batch->x[k], ly = light->center.y - batch->y[k], lz = light->center.z - batch->z[k];
+			float length = sqrt((double) lx * lx + (double) ly * ly + (double) lz * lz);
+
+			lx /= length;
+			ly /= length;
+			lz /= length;
+			batch->lx[k] = lx;
+			batch->ly[k] = ly;
+			batch->lz[k] = lz;
+			batch->distance[k] = length;
+			batch->lambert[k] = batch->nx[k] * lx + batch->ny[k] * ly + batch->nz[k] * lz;
+			batch->visible[k] = batch->lambert[k] > 0;
+			any += batch->visible[k];
+		}
+
+		if (!any)
+			continue;
+
+		shadowBatch(scene, hits, batch, &members[first], last - first, light);
+
+		for (int e = first; e < last; e++) {
+			int k = members[e];
+
+			if (!batch->visible[k])
+				continue;
+
+			float scale = light->Attenuation(batch->distance[k]);
+			float lambert = batch->lambert[k];
+
+			batch->r[k] = min(batch->r[k] + m->diffuse.r * light->pigment.r * lambert * scale * reflectScale, 255.0f);
+			batch->g[k] = min(batch->g[k] + m->diffuse.g * light->pigment.g * lambert * scale * reflectScale, 255.0f);
+			batch->b[k] = min(batch->b[k] + m->diffuse.b * light->pigment.b * lambert * scale * reflectScale, 255.0f);
+
+			if (!batch->specular[k])
+				continue;
+
+			float hx = batch->vx[k] + batch->lx[k], hy = batch->vy[k] + batch->ly[k], hz = batch->vz[k] + batch->lz[k];
+			float length = sqrt((double) hx * hx + (double) hy * hy + (double) hz * hz);
+
+			hx /= length;
+			hy /= length;
+			hz /= length;
+
+			float highlight = pow(max(hx * batch->nx[k] + hy * batch->ny[k] + hz * batch->nz[k], 0.0f), m->shiny);
+
+			batch->r[k] += m->specular.r * light->pigment.r * highlight * scale;
+			batch->g[k] += m->specular.g * light->pigment.g * highlight * scale;
+			batch->b[k] += m->specular.b * light->pigment.b * highlight * scale;
+		}
+	}
+}
+
+/* Trace the tile's primary rays; hits on plain materials go into hits, the rest are shaded now */
+static void traceTile(Scene *scene, Options *options, Tile *tile, vector<Pigment> *colors, HitBuffer *hits) {
+	int height = options->height;
+
+	for (int i = tile->x0; i < tile->x1; i++) {
+		for (int j = tile->y0; j < tile->y1; j++) {
+			Ray ray = Ray(i, j, options->width, height, &scene->camera);
+			float distance = 10000;
+			Geometry *hit = scene->PrimaryHit(i, j, &ray, &distance);
+
+			if (!hit) {
+				colors->at(i * height + j) = Pigment(0, 0, 0);
+				continue;
+			}
+
+			Material *m = hit->GetMaterial();
+			if (m->finish.reflect || (m->finish.refract && m->pigment.f) || scene->lightTree.samples) {
+				colors->at(i * height + j) = scene->ShadePixel(i, j, &ray, hit, distance, options->samples, options->maxDepth);
+				continue;
+			}
+
+			HitRecord record;
+			hit->SetSurface(&ray, distance, &record);
+			hits->Add(hit, &record, i, j);
+		}
+	}
+}
+
+/* Trace one tile into hits, then shade them a material at a time into colors */
+static void deferTile(Scene *scene, Options *options, Tile *tile, vector<Pigment> *colors, HitBuffer *hits,
+	ShadingBatch *batch) {
+	static thread_local vector<int> order, start;
+	int materials = scene->materials.materials.size(), height = options->height;
+
+	hits->Clear();
+	traceTile(scene, options, tile, colors, hits);
+
+	/* Counting sort of the hits by material */
+	start.assign(materials + 1, 0);
+	for (int h = 0; h < hits->Size(); h++)
+		start[hits->material[h] + 1]++;
+	for (int m = 0; m < materials; m++)
+		start[m + 1] += start[m];
+
+	order.resize(hits->Size());
+	for (int h = 0; h < hits->Size(); h++)
+		order[start[hits->material[h]]++] = h;
+	for (int m = materials; m > 0; m--)
+		start[m] = start[m - 1];
+	start[0] = 0;
+
+	for (int m = 0; m < materials; m++) {
+		if (start[m + 1] == start[m])
+			continue;
+
+		batch->Gather(hits, &order[start[m]], start[m + 1] - start[m]);
+		shadeBatch(scene, hits, batch, scene->materials.Get(m));
+
+		/* Every sample would shade the same, so summing keeps the normal loop's rounding */
+		for (int k = 0; k < batch->count; k++) {
+			Pigment pigment = Pigment(batch->r[k], batch->g[k], batch->b[k]), sum = Pigment(0, 0, 0);
+			int h = batch->index[k];
+
+			for (int s = 0; s < options->samples; s++)
+				sum += pigment;
+			sum *= 1.0 / options->samples;
+
+			colors->at(hits->i[h] * height + hits->j[h]) = sum;
+		}
+	}
+}
+
+void renderDeferred(Scene *scene, Options *options, Image *img, PerfLog *perfLog) {
+	int width = options->width, height = options->height, threads = renderThreads(options);
+	Tile frame = Tile(0, 0, width, height);
+	vector<Tile> tiles = spiralTiles(&frame, options->tileSize);
+	TileScheduler scheduler(tiles.size(), threads);
+	vector<HitBuffer> hits(threads);
+	vector<ShadingBatch> batches(threads);
+	vector<Pigment> colors(width * height);
+	color_t color;
+
+	runTiles(&tiles, &scheduler, threads, perfLog, "deferred", [&](int worker, Tile *tile) {
+		deferTile(scene, options, tile, &colors, &hits[worker], &batches[worker]);
+	});
+
+	/* Image::pixel tracks the brightest value, so pixels go in from this thread only */
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			colors[i * height + j].SetColorT(&color);
+			img->pixel(i, j, color);
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "objs.h"
+#include "scene.h"
+#include "options.h"
+#include "perf.h"
+#include "Image.h"
+#include <vector>
+using namespace std;
+
+/* Primary hits waiting to be shaded, one array per attribute so the shading loops stream through them */
+class HitBuffer {
+public:
+	void Clear();
+	void Add(Geometry *geom, HitRecord *record, int i, int j);
+	int Size();
+	vector<float> x, y, z; /* point on geometry */
+	vector<float> nx, ny, nz; /* normal */
+	vector<int> material, i, j;
+	vector<char> specular;
+};
+
+/* Fill img a --tile-size tile at a time on the tile scheduler: each worker traces a tile's primary rays */
+/* into its own HitBuffer, which is then shaded one material at a time. Reflective and */
+/* refractive hits, and sampled lights, are shaded right away like the normal loop */
+void renderDeferred(Scene *scene, Options *options, Image *img, PerfLog *perfLog);
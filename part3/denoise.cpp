@@ -0,0 +1,181 @@
+#include "denoise.h"
+#include "scene.h"
+#include "gbuffer.h"
+#include "objs.h"
+#include "options.h"
+#include "Image.h"
+#include "render.h"
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/* Edge stopping widths: color (in multiples of the estimated noise, halved every pass), */
+/* normal difference and relative depth */
+const float SIGMA_COLOR = 8, SIGMA_NORMAL = 0.3, SIGMA_DEPTH = 0.02;
+
+static const float kernel[3] = {3 / 8.0, 1 / 4.0, 1 / 16.0};
+
+/* Normals, depth and albedo along the pixel center rays, from the G-buffer when there is one */
+void GuideBuffers::Trace(Scene *scene, int width, int height) {
+	this->width = width;
+	this->height = height;
+	normal.assign(3 * width * height, 0);
+	depth.assign(width * height, 0);
+	albedo.assign(3 * width * height, 1);
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			int pixel = i * height + j;
+			Ray ray = Ray(i, j, width, height, &scene->camera);
+			float distance = 10000;
+			Geometry *hit = scene->PrimaryHit(i, j, &ray, &distance);
+
+			if (!hit)
+				continue;
+
+			Material *m = hit->GetMaterial();
+			Point point = Point(&ray, distance);
+			Vector n = hit->NormalAt(&point);
+
+			if (n.Dot(&ray.direction) > 0)
+				n *= -1;
+
+			/* Mirrors and glass show other objects' colors, so only the diffuse part is the surface's own */
+			float local = max(1 - m->finish.reflect - m->finish.refract * m->pigment.f, 0.0f);
+
+			normal[3 * pixel] = n.x;
+			normal[3 * pixel + 1] = n.y;
+			normal[3 * pixel + 2] = n.z;
+			depth[pixel] = distance;
+			albedo[3 * pixel] = max(local * m->pigment.r + 1 - local, 0.01f);
+			albedo[3 * pixel + 1] = max(local * m->pigment.g + 1 - local, 0.01f);
+			albedo[3 * pixel + 2] = max(local * m->pigment.b + 1 - local, 0.01f);
+		}
+	}
+}
+
+/* Standard deviation of the noise in color, from the median difference between each hit */
+/* and its right and lower neighbours on the same surface. Most of those differences are */
+/* noise, while edges and shading changes are rare enough not to move the median */
+static float estimateNoise(GuideBuffers *guide, vector<float> *color) {
+	int width = guide->width, height = guide->height;
+	vector<float> differences;
+
+	for (int i = 0; i + 1 < width; i++) {
+		for (int j = 0; j + 1 < height; j++) {
+			int p = i * height + j, neighbours[2] = {p + height, p + 1};
+
+			for (int k = 0; k < 2; k++) {
+				int q = neighbours[k];
+
+				if (!guide->depth[p] || !guide->depth[q])
+					continue;
+
+				for (int c = 0; c < 3; c++)
+					differences.push_back(fabs((*color)[3 * p + c] - (*color)[3 * q + c]));
+			}
+		}
+	}
+
+	if (differences.empty())
+		return 0;
+
+	/* For Gaussian noise the difference of two pixels has median 0.954 sigma */
+	nth_element(differences.begin(), differences.begin() + differences.size() / 2, differences.end());
+	return differences[differences.size() / 2] / 0.954;
+}
+
+/* One A-trous pass over columns [first, last) of in, sampling neighbours step pixels apart */
+static void filterColumns(GuideBuffers *guide, vector<float> *in, vector<float> *out, int step, float sigmaColor, int first, int last) {
+	int width = guide->width, height = guide->height;
+
+	for (int i = first; i < last; i++) {
+		for (int j = 0; j < height; j++) {
+			int p = i * height + j;
+			float *c = &(*in)[3 * p], *n = &guide->normal[3 * p], sum[3] = {0, 0, 0}, weights = 0;
+
+			for (int dx = -2; dx <= 2; dx++) {
+				for (int dy = -2; dy <= 2; dy++) {
+					int qi = i + dx * step, qj = j + dy * step;
+
+					if (qi < 0 || qi >= width || qj < 0 || qj >= height)
+						continue;
+
+					int q = qi * height + qj;
+					float *cq = &(*in)[3 * q], *nq = &guide->normal[3 * q];
+					float colorDistance = (c[0] - cq[0]) * (c[0] - cq[0]) + (c[1] - cq[1]) * (c[1] - cq[1]) + (c[2] - cq[2]) * (c[2] - cq[2]);
+					float normalDistance = (n[0] - nq[0]) * (n[0] - nq[0]) + (n[1] - nq[1]) * (n[1] - nq[1]) + (n[2] - nq[2]) * (n[2] - nq[2]);
+					float depthDistance = fabs(guide->depth[p] - guide->depth[q]) / (SIGMA_DEPTH * max(guide->depth[p], 1.0f) * step);
+
+					/* Misses and hits never mix */
+					if (!guide->depth[p] != !guide->depth[q])
+						continue;
+
+					float w = kernel[abs(dx)] * kernel[abs(dy)] * exp(-colorDistance / (sigmaColor * sigmaColor) -
+						normalDistance / (SIGMA_NORMAL * SIGMA_NORMAL) - depthDistance * depthDistance);
+
+					sum[0] += w * cq[0];
+					sum[1] += w * cq[1];
+					sum[2] += w * cq[2];
+					weights += w;
+				}
+			}
+
+			/* The center always has weight 9/64, so weights is never 0 */
+			(*out)[3 * p] = sum[0] / weights;
+			(*out)[3 * p + 1] = sum[1] / weights;
+			(*out)[3 * p + 2] = sum[2] / weights;
+		}
+	}
+}
+
+void denoise(Scene *scene, Options *options, Image *in, Image *out) {
+	int width = options->width, height = options->height;
+	int threads = renderThreads(options);
+	vector<float> current(3 * width * height), next(3 * width * height);
+	GuideBuffers guide;
+	color_t color;
+
+	guide.Trace(scene, width, height);
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			int p = i * height + j;
+
+			color = in->pixel(i, j);
+			current[3 * p] = color.r / 255 / guide.albedo[3 * p];
+			current[3 * p + 1] = color.g / 255 / guide.albedo[3 * p + 1];
+			current[3 * p + 2] = color.b / 255 / guide.albedo[3 * p + 2];
+		}
+	}
+
+	/* A clean render keeps a little filtering, so flat areas still lose stray speckles */
+	float noise = max(estimateNoise(&guide, &current), 1 / 255.0f);
+
+	/* Each pass splits the columns between the threads; the next pass needs all of them */
+	for (int pass = 0; pass < options->denoise; pass++) {
+		float sigmaColor = SIGMA_COLOR * noise / (1 << pass);
+		vector<thread> workers;
+
+		for (int t = 0; t < threads; t++)
+			workers.push_back(thread(filterColumns, &guide, &current, &next, 1 << pass, sigmaColor, width * t / threads,
+				width * (t + 1) / threads));
+
+		for (int t = 0; t < workers.size(); t++)
+			workers[t].join();
+
+		current.swap(next);
+	}
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			int p = i * height + j;
+
+			Pigment(current[3 * p] * guide.albedo[3 * p], current[3 * p + 1] * guide.albedo[3 * p + 1],
+				current[3 * p + 2] * guide.albedo[3 * p + 2]).SetColorT(&color);
+			out->pixel(i, j, color);
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "scene.h"
+#include "options.h"
+#include "Image.h"
+#include <vector>
+using namespace std;
+
+/* Per pixel surface data from the primary ray through each pixel center, used to keep */
+/* the denoiser from blurring across edges */
+class GuideBuffers {
+public:
+	void Trace(Scene *scene, int width, int height);
+	int width, height;
+	vector<float> normal; /* 3 per pixel, facing the camera */
+	vector<float> depth; /* distance to the hit, 0 on a miss */
+	vector<float> albedo; /* 3 per pixel, the color light picks up at the hit, 1 on a miss */
+};
+
+/* Edge-aware A-trous wavelet filter (Dammertz et al. 2010) over options->denoise passes */
+/* of a 5 x 5 B3 spline kernel with holes, its reach doubling each pass. Neighbours count */
+/* less the more their color, normal and depth differ; filtering runs on color / albedo */
+/* so flat shading is smoothed without washing out materials. Writes the result to out */
+void denoise(Scene *scene, Options *options, Image *in, Image *out);
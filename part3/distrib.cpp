@@ -0,0 +1,352 @@
+#include "distrib.h"
+#include "render.h"
+#include "parse.h"
+#include "objs.h"
+#include "timer.h"
+#include "net.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+using namespace std;
+
+/* The wire format is int32s and floats in host byte order, so the coordinator and its */
+/* workers must share an architecture.
+ *   coordinator -> worker: argument count, each argument, the .pov text (strings are a
+ *                          length then bytes), then tiles as x0 y0 x1 y1; x0 = -1 ends the frame
+ *   worker -> coordinator: per tile, its x0 y0 x1 y1 then r g b f for each pixel, column by column */
+
+static const int TILES_IN_FLIGHT = 2; /* per connection, so a worker isn't idle while its next tile is on the way */
+static const int CONNECT_SECONDS = 10; /* how long a worker keeps trying a coordinator that isn't listening yet */
+static const int SEND_SECONDS = 10; /* how long the coordinator waits on a worker that stopped reading before dropping it */
+
+/* Our arguments and the scene text, everything a worker needs to render like we would */
+static int jobMessage(Options *options, string *job) {
+	ifstream povray(options->fileName.c_str(), ios::binary);
+	stringstream text;
+
+	if (!povray.is_open()) {
+		cout << "Error opening file." << endl;
+		return 1;
+	}
+
+	text << povray.rdbuf();
+
+	appendInt(job, options->arguments.size());
+	for (int a = 0; a < options->arguments.size(); a++)
+		appendString(job, options->arguments[a]);
+	appendString(job, text.str());
+	return 0;
+}
+
+/* A worker connection and the tiles it holds, in the order it will return them */
+class WorkerLink {
+public:
+	int fd;
+	deque<int> tiles;
+	string received; /* bytes of results not yet complete */
+};
+
+/* Keep the link TILES_IN_FLIGHT deep from the front of the queue; false if the send failed */
+static bool sendTiles(WorkerLink *link, deque<int> *queue, vector<Tile> *tiles) {
+	while (link->tiles.size() < TILES_IN_FLIGHT && queue->size()) {
+		Tile *tile = &tiles->at(queue->front());
+		int32_t message[4] = {tile->x0, tile->y0, tile->x1, tile->y1};
+
+		if (!sendAll(link->fd, message, sizeof(message)))
+			return false;
+
+		link->tiles.push_back(queue->front());
+		queue->pop_front();
+	}
+
+	return true;
+}
+
+/* Read whatever the worker has sent and store each complete tile. False once the worker */
+/* has gone away or sent something other than the tile it was given */
+static bool receiveTiles(WorkerLink *link, vector<Tile> *tiles, vector<Pigment> *colors, int height, int *finished) {
+	char chunk[1 << 16];
+	bool open = true;
+
+	while (true) {
+		ssize_t got = recv(link->fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+
+		if (got > 0)
+			link->received.append(chunk, got);
+		else if (got < 0 && errno == EINTR)
+			continue;
+		else {
+			open = got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+			break;
+		}
+	}
+
+	while (link->tiles.size()) {
+		Tile *tile = &tiles->at(link->tiles.front());
+		int32_t header[4];
+		size_t size = sizeof(header) + (tile->x1 - tile->x0) * (tile->y1 - tile->y0) * sizeof(Pigment);
+		const char *pixel = link->received.data() + sizeof(header);
+
+		if (link->received.size() < size)
+			break;
+
+		memcpy(header, link->received.data(), sizeof(header));
+		if (header[0] != tile->x0 || header[1] != tile->y0 || header[2] != tile->x1 || header[3] != tile->y1)
+			return false;
+
+		for (int i = tile->x0; i < tile->x1; i++) {
+			for (int j = tile->y0; j < tile->y1; j++) {
+				memcpy(&colors->at(i * height + j), pixel, sizeof(Pigment));
+				pixel += sizeof(Pigment);
+			}
+		}
+
+		link->received.erase(0, size);
+		link->tiles.pop_front();
+		(*finished)++;
+	}
+
+	return open;
+}
+
+int renderDistributed(Scene *scene, Options *options, Image *img) {
+	int width = options->width, height = options->height, listener, finished = 0, joined = 0, reissued = 0;
+	Tile region = renderRegion(options);
+	vector<Tile> tiles = spiralTiles(&region, options->tileSize);
+	vector<Pigment> colors(width * height);
+	vector<WorkerLink> links;
+	deque<int> queue;
+	color_t color;
+	string job;
+	Timer timer;
+
+	if (jobMessage(options, &job) || (listener = listenOn(options->listen.c_str())) < 0)
+		return 1;
+
+	for (int t = 0; t < tiles.size(); t++)
+		queue.push_back(t);
+
+	printf("Waiting for workers on %s.\n", options->listen.c_str());
+	fflush(stdout);
+
+	while (finished < tiles.size()) {
+		vector<pollfd> fds(links.size() + 1);
+		vector<bool> lost(links.size(), false);
+
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (int l = 0; l < links.size(); l++) {
+			fds[l + 1].fd = links[l].fd;
+			fds[l + 1].events = POLLIN;
+		}
+
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			cout << "Error. Waiting on workers failed: " << strerror(errno) << endl;
+			close(listener);
+			return 1;
+		}
+
+		for (int l = 0; l < links.size(); l++)
+			if (fds[l + 1].revents)
+				lost[l] = !receiveTiles(&links[l], &tiles, &colors, height, &finished);
+
+		/* A lost worker's tiles go to the front, they're next in spiral order */
+		for (int l = links.size() - 1; l >= 0; l--) {
+			if (!lost[l])
+				continue;
+
+			printf("Worker connection lost, reissuing %d tiles.\n", (int) links[l].tiles.size());
+			reissued += links[l].tiles.size();
+			queue.insert(queue.begin(), links[l].tiles.begin(), links[l].tiles.end());
+			close(links[l].fd);
+			links.erase(links.begin() + l);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			WorkerLink link;
+
+			link.fd = accept(listener, NULL, NULL);
+			if (link.fd >= 0)
+				sendTimeout(link.fd, SEND_SECONDS);
+
+			if (link.fd >= 0 && sendAll(link.fd, job.data(), job.size())) {
+				noDelay(link.fd);
+				links.push_back(link);
+				joined++;
+			}
+			else if (link.fd >= 0)
+				close(link.fd);
+		}
+
+		/* Tiles may have come back from a lost worker, so top up every link, not just the ones that */
+		/* answered. A send fails after SEND_SECONDS on a worker that stopped reading, and its tiles */
+		/* go to the others */
+		for (int l = links.size() - 1; l >= 0; l--) {
+			if (sendTiles(&links[l], &queue, &tiles))
+				continue;
+
+			printf("Worker stopped taking tiles, reissuing %d tiles.\n", (int) links[l].tiles.size());
+			reissued += links[l].tiles.size();
+			queue.insert(queue.begin(), links[l].tiles.begin(), links[l].tiles.end());
+			close(links[l].fd);
+			links.erase(links.begin() + l);
+		}
+	}
+
+	for (int l = 0; l < links.size(); l++) {
+		int32_t done[4] = {-1, -1, -1, -1};
+
+		sendAll(links[l].fd, done, sizeof(done));
+		close(links[l].fd);
+	}
+
+	close(listener);
+	if (localSocket(options->listen.c_str()))
+		unlink(options->listen.c_str());
+
+	/* Image::pixel tracks the brightest value, so pixels go in from this thread only */
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			colors[i * height + j].SetColorT(&color);
+			img->pixel(i, j, color);
+		}
+	}
+
+	printf("Distributed %d tiles over %d worker connections in %.2fs, %d reissued.\n", (int) tiles.size(), joined,
+		timer.Seconds(), reissued);
+	return 0;
+}
+
+/* The job a worker's connections render. Every connection is sent it, the first to get it */
+/* parses it once, and the rest share that scene, which tiles only read */
+class WorkerJob {
+public:
+	WorkerJob();
+	mutex lock;
+	bool loaded;
+	int status; /* 0 once options and scene are ready */
+	vector<string> arguments;
+	string text;
+	Options options;
+	Scene scene;
+};
+
+WorkerJob::WorkerJob() {
+	loaded = false;
+	status = 1;
+}
+
+/* Load the job a connection received into job, unless an earlier connection has. Returns */
+/* 1, with the error printed, if it doesn't parse or isn't the job the others got */
+static int loadJob(const char *address, WorkerJob *job, vector<string> *arguments, string *text) {
+	lock_guard<mutex> guard(job->lock);
+	vector<char *> argv(1, (char *) "raytrace");
+
+	if (job->loaded) {
+		if (*arguments == job->arguments && *text == job->text)
+			return job->status;
+
+		cout << "Error. Coordinator " << address << " sent connections different jobs." << endl;
+		return 1;
+	}
+
+	job->loaded = true;
+	job->arguments = *arguments;
+	job->text = *text;
+
+	for (int a = 0; a < job->arguments.size(); a++)
+		argv.push_back((char *) job->arguments[a].c_str());
+
+	job->status = parseOptions(argv.size(), &argv[0], &job->options) || sceneFromText(&job->options, &job->scene, &job->text);
+	return job->status;
+}
+
+/* One connection: take the job, then render tiles until told to stop */
+static int workConnection(const char *address, WorkerJob *job, int *tilesDone) {
+	int fd = connectTo(address, "coordinator", CONNECT_SECONDS);
+	vector<string> arguments;
+	int32_t count;
+	string text;
+
+	if (fd < 0)
+		return 1;
+
+	bool received = receiveAll(fd, &count, sizeof(count)) && count >= 0;
+	for (int a = 0; received && a < count; a++) {
+		arguments.push_back("");
+		received = receiveString(fd, &arguments.back(), MAX_ARGUMENT);
+	}
+
+	if (!received || !receiveString(fd, &text, MAX_TEXT)) {
+		cout << "Error. Coordinator " << address << " closed before sending the job." << endl;
+		close(fd);
+		return 1;
+	}
+
+	if (loadJob(address, job, &arguments, &text)) {
+		close(fd);
+		return 1;
+	}
+
+	Options *options = &job->options;
+
+	while (true) {
+		int32_t tile[4];
+		string result;
+
+		/* The coordinator finishing without saying so is fine, it may have all it needs */
+		if (!receiveAll(fd, tile, sizeof(tile)) || tile[0] < 0)
+			break;
+
+		result.append((const char *) tile, sizeof(tile));
+		for (int i = tile[0]; i < tile[2]; i++) {
+			for (int j = tile[1]; j < tile[3]; j++) {
+				Pigment pixel = job->scene.TracePixel(i, j, options->width, options->height, options->samples, options->maxDepth);
+
+				result.append((const char *) &pixel, sizeof(pixel));
+			}
+		}
+
+		if (!sendAll(fd, result.data(), result.size()))
+			break;
+		(*tilesDone)++;
+	}
+
+	close(fd);
+	return 0;
+}
+
+int runWorker(Options *options) {
+	int threads = renderThreads(options), tiles = 0, failed = 0;
+	vector<int> tilesDone(threads, 0), status(threads, 0);
+	vector<thread> workers;
+	WorkerJob job;
+
+	for (int t = 0; t < threads; t++)
+		workers.push_back(thread([&, t]() {
+			status[t] = workConnection(options->worker.c_str(), &job, &tilesDone[t]);
+		}));
+
+	for (int t = 0; t < threads; t++) {
+		workers[t].join();
+		tiles += tilesDone[t];
+		failed += status[t];
+	}
+
+	printf("Worker rendered %d tiles on %d connections.\n", tiles, threads);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "scene.h"
+#include "options.h"
+#include "Image.h"
+using namespace std;
+
+/* --listen: wait for --worker processes on options->listen and deal them the tiles of the */
+/* render. Tiles held by a worker that goes away, or stops reading for SEND_SECONDS, go back */
+/* on the queue for the others, so the frame finishes as long as one worker is left or joins */
+/* later. Returns 1 if the address can't be listened on or the scene can't be read */
+int renderDistributed(Scene *scene, Options *options, Image *img);
+
+/* --worker: connect to the coordinator once per thread and render tiles until it says the */
+/* frame is done. The scene it sends is parsed once and shared by every connection. Returns */
+/* 1 if a connection failed */
+int runWorker(Options *options);
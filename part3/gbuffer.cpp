@@ -0,0 +1,151 @@
+#include "gbuffer.h"
+#include "scene.h"
+#include "objs.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+using namespace std;
+
+static const char magic[4] = {'R', 'T', 'G', 'B'};
+
+GBuffer::GBuffer() {
+	key = 0;
+	width = height = 0;
+}
+
+/* FNV-1a over raw bytes */
+static void hashBytes(uint64_t *hash, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char *) data;
+
+	for (size_t b = 0; b < size; b++) {
+		*hash ^= bytes[b];
+		*hash *= 1099511628211ULL;
+	}
+}
+
+uint64_t gbufferKey(Scene *scene, int width, int height) {
+	uint64_t hash = 14695981039346656037ULL;
+	Camera *camera = &scene->camera;
+	float view[12] = {camera->center.x, camera->center.y, camera->center.z, camera->up.x, camera->up.y, camera->up.z,
+		camera->right.x, camera->right.y, camera->right.z, camera->lookat.x, camera->lookat.y, camera->lookat.z};
+	vector<float> shape;
+
+	hashBytes(&hash, &width, sizeof(width));
+	hashBytes(&hash, &height, sizeof(height));
+	hashBytes(&hash, view, sizeof(view));
+
+	for (int g = 0; g < scene->allGeometry.size(); g++) {
+		const char *type = scene->allGeometry[g]->TypeName();
+
+		shape.clear();
+		scene->allGeometry[g]->AppendShape(&shape);
+		hashBytes(&hash, type, strlen(type) + 1);
+		hashBytes(&hash, shape.data(), shape.size() * sizeof(float));
+	}
+
+	return hash;
+}
+
+/* Trace every primary ray and remember what it hit */
+void GBuffer::Trace(Scene *scene, int width, int height) {
+	this->width = width;
+	this->height = height;
+	key = gbufferKey(scene, width, height);
+	object.assign(width * height, -1);
+	distance.assign(width * height, 0);
+
+	unordered_map<Geometry *, int> index;
+	for (int g = 0; g < scene->allGeometry.size(); g++)
+		index[scene->allGeometry[g]] = g;
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			Ray ray = Ray(i, j, width, height, &scene->camera);
+			float closest = 10000;
+			raysTraced++;
+
+			Geometry *hit = closestHit(&scene->allGeometry, i, j, &ray, &closest);
+
+			if (hit) {
+				object[i * height + j] = index[hit];
+				distance[i * height + j] = closest;
+			}
+		}
+	}
+}
+
+/* Read a saved buffer for key at width x height; false if it's missing, unreadable or for */
+/* another scene or size. The header is checked before anything is sized from it */
+bool GBuffer::Load(const char *fileName, uint64_t key, int width, int height) {
+	FILE *in = fopen(fileName, "rb");
+	uint64_t savedKey;
+	int savedWidth, savedHeight;
+	char header[4];
+	bool ok;
+
+	if (!in)
+		return false;
+
+	ok = fread(header, 1, 4, in) == 4 && !memcmp(header, magic, 4) && fread(&savedKey, sizeof(savedKey), 1, in) == 1 &&
+		fread(&savedWidth, sizeof(savedWidth), 1, in) == 1 && fread(&savedHeight, sizeof(savedHeight), 1, in) == 1 &&
+		savedKey == key && savedWidth == width && savedHeight == height;
+
+	if (ok) {
+		this->key = key;
+		this->width = width;
+		this->height = height;
+		object.resize(width * height);
+		distance.resize(width * height);
+		ok = fread(object.data(), sizeof(int), object.size(), in) == object.size() &&
+			fread(distance.data(), sizeof(float), distance.size(), in) == distance.size();
+	}
+
+	fclose(in);
+	return ok;
+}
+
+bool GBuffer::Save(const char *fileName) {
+	FILE *out = fopen(fileName, "wb");
+	bool ok;
+
+	if (!out)
+		return false;
+
+	ok = fwrite(magic, 1, 4, out) == 4 && fwrite(&key, sizeof(key), 1, out) == 1 &&
+		fwrite(&width, sizeof(width), 1, out) == 1 && fwrite(&height, sizeof(height), 1, out) == 1 &&
+		fwrite(object.data(), sizeof(int), object.size(), out) == object.size() &&
+		fwrite(distance.data(), sizeof(float), distance.size(), out) == distance.size();
+
+	return !fclose(out) && ok;
+}
+
+/* Cached primary hit for pixel (i, j), NULL on a miss */
+Geometry *GBuffer::Hit(Scene *scene, int i, int j, float *distance) {
+	int g = object[i * height + j];
+
+	if (g < 0)
+		return NULL;
+
+	*distance = this->distance[i * height + j];
+	return scene->allGeometry[g];
+}
+
+/* Point scene at the buffer in fileName, tracing and saving a new one if it's missing or stale */
+void useGBuffer(const char *fileName, Scene *scene, GBuffer *gbuffer, int width, int height) {
+	if (gbuffer->Load(fileName, gbufferKey(scene, width, height), width, height)) {
+		cout << "G-buffer " << fileName << " reused, shading only." << endl;
+	}
+	else {
+		gbuffer->Trace(scene, width, height);
+
+		if (gbuffer->Save(fileName))
+			cout << "G-buffer " << fileName << " traced and saved." << endl;
+		else
+			cout << "Error writing G-buffer " << fileName << ", continuing without saving." << endl;
+	}
+
+	scene->gbuffer = gbuffer;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "objs.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Primary hits for every pixel, kept on disk so look-dev renders that only change lights */
+/* or finishes can skip primary intersection. The key covers camera, geometry shapes and */
+/* resolution; materials and lights are left out on purpose */
+class GBuffer {
+public:
+	GBuffer();
+	void Trace(class Scene *scene, int width, int height);
+	bool Load(const char *fileName, uint64_t key, int width, int height);
+	bool Save(const char *fileName);
+	Geometry *Hit(class Scene *scene, int i, int j, float *distance);
+	uint64_t key;
+	int width, height;
+	vector<int> object; /* index into allGeometry, -1 on a miss */
+	vector<float> distance; /* T along the primary ray */
+};
+
+/* Load fileName if it matches this scene and size, otherwise trace and save it, then point scene at it */
+void useGBuffer(const char *fileName, class Scene *scene, GBuffer *gbuffer, int width, int height);
+
+/* Hash of everything that decides where primary rays land */
+uint64_t gbufferKey(class Scene *scene, int width, int height);
@@ -0,0 +1,208 @@
+#include "lights.h"
+#include "objs.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+LightNode::LightNode() {
+	for (int axis = 0; axis < 3; axis++) {
+		min[axis] = INFINITY;
+		max[axis] = -INFINITY;
+	}
+	left = right = -1;
+	first = count = 0;
+}
+
+/* Vose's method: split every weight into a kept share and a share donated to an alias */
+void AliasTable::Build(vector<float> *weights) {
+	float total = 0;
+	int n = weights->size();
+
+	probability.assign(n, 1);
+	alias.assign(n, 0);
+	pdf.assign(n, 0);
+	small.clear();
+	large.clear();
+
+	for (int k = 0; k < n; k++)
+		total += weights->at(k);
+
+	if (total <= 0)
+		return;
+
+	for (int k = 0; k < n; k++) {
+		pdf[k] = weights->at(k) / total;
+		probability[k] = pdf[k] * n;
+		alias[k] = k;
+		if (probability[k] < 1)
+			small.push_back(k);
+		else
+			large.push_back(k);
+	}
+
+	while (small.size() && large.size()) {
+		int less = small.back(), more = large.back();
+		small.pop_back();
+
+		alias[less] = more;
+		probability[more] -= 1 - probability[less];
+
+		if (probability[more] < 1) {
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+
+	/* Whatever is left is 1 up to rounding */
+	for (int k = 0; k < small.size(); k++)
+		probability[small[k]] = 1;
+	for (int k = 0; k < large.size(); k++)
+		probability[large[k]] = 1;
+}
+
+/* u1 picks a column, u2 picks between it and its alias */
+int AliasTable::Sample(float u1, float u2, float *pdf) {
+	int n = probability.size();
+	int k = (int) (u1 * n);
+
+	if (k >= n)
+		k = n - 1;
+	if (u2 >= probability[k])
+		k = alias[k];
+
+	*pdf = this->pdf[k];
+	return k;
+}
+
+LightTree::LightTree() {
+	ambient = Pigment();
+	samples = 0;
+}
+
+static float axisOf(Point *point, int axis) {
+	return axis == 0 ? point->x : axis == 1 ? point->y : point->z;
+}
+
+/* Sort key for the current split, set before each sort in BuildNode */
+static int splitAxis;
+
+static bool lessOnAxis(Light *a, Light *b) {
+	return axisOf(&a->center, splitAxis) < axisOf(&b->center, splitAxis);
+}
+
+void LightTree::Build(vector<Light *> *lights, float cutoff) {
+	ambient = Pigment();
+	global.clear();
+	local.clear();
+	nodes.clear();
+
+	for (int l = 0; l < lights->size(); l++) {
+		Light *light = lights->at(l);
+
+		ambient.r += light->pigment.r;
+		ambient.g += light->pigment.g;
+		ambient.b += light->pigment.b;
+
+		light->SetRadius(cutoff);
+		if (light->radius == INFINITY)
+			global.push_back(light);
+		else if (light->radius > 0)
+			local.push_back(light);
+	}
+
+	ambient.r = ambient.r > 1 ? 1 : ambient.r;
+	ambient.g = ambient.g > 1 ? 1 : ambient.g;
+	ambient.b = ambient.b > 1 ? 1 : ambient.b;
+
+	if (local.size())
+		BuildNode(0, local.size());
+
+	/* Query returns global lights, then the leaves in its traversal order (right child */
+	/* first); any point's lights are a subsequence of this, so callers can merge by rank */
+	int rank = 0, stack[64], top = 0;
+	for (int l = 0; l < global.size(); l++)
+		global[l]->rank = rank++;
+	if (nodes.size())
+		stack[top++] = 0;
+	while (top) {
+		LightNode *node = &nodes[stack[--top]];
+
+		if (node->left < 0) {
+			for (int l = node->first; l < node->first + node->count; l++)
+				local[l]->rank = rank++;
+		}
+		else {
+			stack[top++] = node->left;
+			stack[top++] = node->right;
+		}
+	}
+}
+
+/* Median split on the widest axis of the light centers, four lights to a leaf */
+int LightTree::BuildNode(int first, int count) {
+	int index = nodes.size();
+	float centerMin[3] = {INFINITY, INFINITY, INFINITY}, centerMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+	LightNode node;
+
+	for (int l = first; l < first + count; l++) {
+		for (int axis = 0; axis < 3; axis++) {
+			float center = axisOf(&local[l]->center, axis);
+			node.min[axis] = min(node.min[axis], center - local[l]->radius);
+			node.max[axis] = max(node.max[axis], center + local[l]->radius);
+			centerMin[axis] = min(centerMin[axis], center);
+			centerMax[axis] = max(centerMax[axis], center);
+		}
+	}
+
+	node.first = first;
+	node.count = count;
+	nodes.push_back(node);
+
+	if (count <= 4)
+		return index;
+
+	splitAxis = 0;
+	for (int axis = 1; axis < 3; axis++)
+		if (centerMax[axis] - centerMin[axis] > centerMax[splitAxis] - centerMin[splitAxis])
+			splitAxis = axis;
+
+	int half = count / 2;
+	nth_element(local.begin() + first, local.begin() + first + half, local.begin() + first + count, lessOnAxis);
+
+	/* nodes may reallocate while children are built, so index rather than hold a pointer */
+	int left = BuildNode(first, half);
+	int right = BuildNode(first + half, count - half);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	return index;
+}
+
+/* Append every light whose reach contains point to result */
+void LightTree::Query(Point *point, vector<Light *> *result) {
+	int stack[64], top = 0;
+
+	result->insert(result->end(), global.begin(), global.end());
+
+	if (nodes.empty())
+		return;
+
+	stack[top++] = 0;
+	while (top) {
+		LightNode *node = &nodes[stack[--top]];
+
+		if (point->x < node->min[0] || point->x > node->max[0] || point->y < node->min[1] ||
+			point->y > node->max[1] || point->z < node->min[2] || point->z > node->max[2])
+			continue;
+
+		if (node->left < 0) {
+			for (int l = node->first; l < node->first + node->count; l++)
+				if (point->Distance(&local[l]->center) < local[l]->radius)
+					result->push_back(local[l]);
+		}
+		else {
+			stack[top++] = node->left;
+			stack[top++] = node->right;
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "objs.h"
+#include <vector>
+using namespace std;
+
+/* Node of the light hierarchy; leaves own a run of LightTree::local */
+class LightNode {
+public:
+	LightNode();
+	float min[3], max[3]; /* box around the reach of every light below */
+	int left, right; /* child node indices, -1 for a leaf */
+	int first, count; /* leaf's run in LightTree::local */
+};
+
+/* Walker alias table: picks index k with probability weight[k] / sum in constant time */
+class AliasTable {
+public:
+	void Build(vector<float> *weights);
+	int Sample(float u1, float u2, float *pdf);
+	vector<float> probability, pdf;
+	vector<int> alias, small, large; /* small and large are kept to reuse their storage */
+};
+
+/* Finds the lights that can reach a point. Lights with fade_distance get a finite */
+/* radius beyond which they contribute less than the cutoff, and are kept in a BVH; */
+/* lights without fade reach everywhere and are always returned. */
+class LightTree {
+public:
+	LightTree();
+	void Build(vector<Light *> *lights, float cutoff);
+	void Query(Point *point, vector<Light *> *result);
+	Pigment ambient; /* capped sum of light colors, used for every ambient term */
+	int samples; /* lights drawn per hit in stochastic mode, 0 to visit every nearby light */
+	vector<Light *> global;
+	vector<Light *> local;
+	vector<LightNode> nodes;
+
+private:
+	int BuildNode(int first, int count);
+};
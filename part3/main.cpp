@@ -1,5 +1,23 @@
 #include "parse.h"
+#include "scene.h"
 #include "objs.h"
+#include "options.h"
+#include "debug.h"
+#include "regress.h"
+#include "timer.h"
+#include "perf.h"
+#include "profile.h"
+#include "deferred.h"
+#include "gbuffer.h"
+#include "antialias.h"
+#include "pathtrace.h"
+#include "denoise.h"
+#include "render.h"
+#include "progressive.h"
+#include "distrib.h"
+#include "checkpoint.h"
+#include "batch.h"
+#include "serve.h"
 #include "Image.h"
 #include <vector>
 #include <iostream>
@@ -12,80 +30,129 @@
 using namespace std;
 
 int main(int argc, char *argv[]) {
-	string result = "";
-	int width, height, curGeom;
-	float distance;
-	Light light;
-	Camera camera;
-	color_t color, black = {0, 0, 0, 0}, white = {255, 255, 255, 0};
-	vector<Geometry *> allGeometry;
+	int width, height;
+	Options options;
+	PerfCounters counters;
+	PerfLog perfLog;
+	Scene scene;
+
+	/* Read width, height, file name and flags; parseOptions prints usage on error */
+	if (parseOptions(argc, argv, &options))
+		return 1;
+
+	/* Workers take the scene and settings from their coordinator */
+	if (options.worker.size())
+		return runWorker(&options);
+
+	/* Batch jobs each parse, render and write their own scene */
+	if (options.batch.size())
+		return runBatch(&options);
+
+	/* The daemon renders requests until it's killed; a client hands its render to one */
+	if (options.serve.size())
+		return runServer(&options);
+	if (options.server.size())
+		return renderOnServer(&options);
+
+	if (options.perf && !counters.Open())
+		cout << "Hardware counters unavailable, reporting time and rays only." << endl;
+
+	if (options.perf)
+		counters.Start("parse", 0);
 
 	/* Attempt to open .pov file, fill in variables, and create geometry */
-	if (fileOps(argc, argv, &width, &height, &allGeometry, &camera, &light))
+	if (fileOps(&options, &scene))
 		/* Otherwise, fileOps prints error message. Quit program. */
 		return 1;
 
+	if (options.perf) {
+		perfLog.Add(counters.Stop());
+		counters.Start("render", 0);
+	}
+
+	if (options.profileTop)
+		startProfile(scene.allGeometry.size());
+
+	width = options.width;
+	height = options.height;
 	Image img(width, height);
+	GBuffer gbuffer;
+	Checkpoint checkpoint;
+	Timer timer;
+
+	if (options.checkpoint.size() && checkpoint.Open(&options))
+		return 1;
 
-	cout << "Reflection on simple_reflect3" << endl;
+	/* Primary hits are traced up front, or not at all when a matching G-buffer is on disk */
+	if (options.gbuffer.size())
+		useGBuffer(options.gbuffer.c_str(), &scene, &gbuffer, width, height);
+
+	/* Anti-aliasing needs every pixel's hit object, so it traces them up front too */
+	else if (options.aa) {
+		gbuffer.Trace(&scene, width, height);
+		scene.gbuffer = &gbuffer;
+	}
 
 	/* Loop through pixels */
-	for (int i = 0; i < width; i++){
-		for (int j = 0; j < height; j++) {
-			Ray ray = Ray(i, j, width, height, &camera);
-			if (i == 320 && j == 145) {
-				cout << "----" << endl << "Iteration type: Primary" << endl;
-				ray.PrintTest();
-				result += "Pixel: [" + to_string(i) + ", " + to_string(j) + "]";
-				result += " Ray: {" + to_string(ray.start.x) + ", " + to_string(ray.start.y) + ", " + to_string(ray.start.z) + "}";
-				result += " -> {" + to_string(ray.direction.x) + ", " + to_string(ray.direction.y) + ", " + to_string(ray.direction.z) + "}";
-			}
-
-			curGeom = -1; // reset curGeom
-			Storage storage = Storage(10000, &black);
-
-			/* Loop through geometry */
-			for (int g = 0; g < allGeometry.size(); g++) {
-				/* Find distance along ray to current geometry */
-				distance = allGeometry.at(g)->Intersect(i, j, &ray);
-
-				/* Update closest distance from camera to geometry */
-				if (distance > 0.001 && distance < storage.distance) {
-				   storage.distance = distance;
-				   curGeom = g;
-				}
-			}
-
-			if (i == 320 && j == 145)
-				result += " T=" + to_string(storage.distance);
-
-			if (storage.distance == 10000 && curGeom == -1) {
-				img.pixel(i, j, black);
-			}
-			
-			else {
-				storage.pigment = allGeometry.at(curGeom)->Reflect(i, j, storage.distance, ray, 0);
-				storage.pigment.SetColorT(&color);
-				
-				if (i == 320 && j == 145) {
-					result += " Color: (" + to_string(color.r) + ", " + to_string(color.g) + ", " + to_string(color.b) + ")";
-				}
-
-				img.pixel(i, j, color);
-			}
-
-			for (int g = 0; g < allGeometry.size(); g++)
-				allGeometry.at(g)->ResetPigments();
+	if (options.path) {
+		PathTracer tracer(&scene, &options);
+		tracer.Render(&img, options.checkpoint.size() ? &checkpoint : NULL);
+	}
+	else if (options.deferred)
+		renderDeferred(&scene, &options, &img, options.perf ? &perfLog : NULL);
+	else if (options.progressive)
+		renderProgressive(&scene, &options, &img);
+	else if (options.listen.size()) {
+		if (renderDistributed(&scene, &options, &img))
+			return 1;
+	}
+	else
+		renderTiles(&scene, &options, &img, options.perf ? &perfLog : NULL, options.checkpoint.size() ? &checkpoint : NULL);
+
+	if (options.aa) {
+		int refined = refineEdges(&scene, &options, &img);
+		printf("Anti-aliasing refined %d of %d pixels (%.1f%%) with %d rays each.\n", refined, width * height,
+			100.0 * refined / (width * height), options.aa * options.aa);
+	}
+
+	/* Filtered into a second image, since img's brightness scale already counts the noise */
+	Image denoised(width, height), *result = &img;
+
+	if (options.denoise) {
+		if (options.perf) {
+			perfLog.Add(counters.Stop());
+			counters.Start("denoise", 0);
 		}
+
+		denoise(&scene, &options, &img, &denoised);
+		result = &denoised;
 	}
 
-	cout << "----" << endl << result << endl;
+	double renderMs = timer.Milliseconds();
 
-	img.WriteTga((char *)"simple_reflect3.tga", true);
+	if (options.profileTop)
+		printProfile(&scene.allGeometry, options.profileTop, options.fileName.c_str());
 
-	return 0;
-}
+	if (options.perf) {
+		perfLog.Add(counters.Stop());
+		counters.Start("write", 0);
+	}
 
+	/* Debug pixels are traced again off the hot path, with a ray tree attached */
+	for (int p = 0; p < options.debugPixels.size(); p++)
+		debugPixel(options.debugPixels[p].i, options.debugPixels[p].j, width, height, &scene.camera, &scene.allGeometry);
 
+	if (writeRender(&options, result))
+		return 1;
 
+	if (options.perf) {
+		perfLog.Add(counters.Stop());
+		perfLog.Print();
+	}
 
+	/* Check against golden image and baseline time, if any were given */
+	if (options.golden.size() || options.baseline.size())
+		return checkRegression(&options, renderMs);
+
+	return 0;
+}
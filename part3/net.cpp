@@ -0,0 +1,205 @@
+#include "net.h"
+#include "timer.h"
+#include <iostream>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+using namespace std;
+
+bool localSocket(const char *address) {
+	return !strchr(address, ':') || strchr(address, '/');
+}
+
+static bool socketAddress(const char *address, bool passive, sockaddr_storage *storage, socklen_t *length) {
+	memset(storage, 0, sizeof(*storage));
+
+	if (localSocket(address)) {
+		sockaddr_un *local = (sockaddr_un *) storage;
+
+		if (strlen(address) >= sizeof(local->sun_path))
+			return false;
+
+		local->sun_family = AF_UNIX;
+		strcpy(local->sun_path, address);
+		*length = sizeof(sockaddr_un);
+		return true;
+	}
+
+	const char *colon = strrchr(address, ':');
+	string host(address, colon - address);
+	addrinfo hints, *found;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	if (getaddrinfo(host.size() ? host.c_str() : NULL, colon + 1, &hints, &found))
+		return false;
+
+	memcpy(storage, found->ai_addr, found->ai_addrlen);
+	*length = found->ai_addrlen;
+	freeaddrinfo(found);
+	return true;
+}
+
+void noDelay(int fd) {
+	int on = 1;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+void sendTimeout(int fd, int seconds) {
+	timeval limit = {seconds, 0};
+
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+}
+
+void receiveTimeout(int fd, int seconds) {
+	timeval limit = {seconds, 0};
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+}
+
+bool sendAll(int fd, const void *data, size_t size) {
+	const char *next = (const char *) data;
+
+	while (size) {
+		ssize_t sent = send(fd, next, size, MSG_NOSIGNAL);
+
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+
+		next += sent;
+		size -= sent;
+	}
+
+	return true;
+}
+
+bool receiveAll(int fd, void *data, size_t size) {
+	char *next = (char *) data;
+
+	while (size) {
+		ssize_t got = recv(fd, next, size, 0);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+
+		next += got;
+		size -= got;
+	}
+
+	return true;
+}
+
+void appendInt(string *message, int32_t value) {
+	message->append((const char *) &value, sizeof(value));
+}
+
+void appendString(string *message, const string &value) {
+	appendInt(message, value.size());
+	message->append(value);
+}
+
+bool receiveString(int fd, string *value, int32_t limit) {
+	int32_t size;
+
+	if (!receiveAll(fd, &size, sizeof(size)) || size < 0 || size > limit)
+		return false;
+
+	/* Grow as the bytes arrive, a peer can claim a length it never sends */
+	value->clear();
+	while (value->size() < size) {
+		size_t start = value->size(), chunk = min((size_t) size - start, (size_t) 1 << 16);
+
+		value->resize(start + chunk);
+		if (!receiveAll(fd, &(*value)[start], chunk))
+			return false;
+	}
+
+	return true;
+}
+
+int listenOn(const char *address) {
+	sockaddr_storage storage;
+	socklen_t length;
+	int fd, on = 1;
+
+	if (!socketAddress(address, true, &storage, &length)) {
+		cout << "Error. Can't listen on " << address << ", expected host:port or a socket path." << endl;
+		return -1;
+	}
+
+	/* A socket file left by an earlier run is replaced, anything else at the path is kept */
+	if (storage.ss_family == AF_UNIX) {
+		struct stat existing;
+
+		if (!lstat(address, &existing)) {
+			if (!S_ISSOCK(existing.st_mode)) {
+				cout << "Error. Can't listen on " << address << ": address in use by a file that isn't a socket." << endl;
+				return -1;
+			}
+			unlink(address);
+		}
+	}
+
+	fd = socket(storage.ss_family, SOCK_STREAM, 0);
+	if (fd >= 0)
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if (fd < 0 || bind(fd, (sockaddr *) &storage, length) || listen(fd, 64)) {
+		cout << "Error. Can't listen on " << address << ": " << strerror(errno) << endl;
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int connectTo(const char *address, const char *what, int retrySeconds) {
+	sockaddr_storage storage;
+	socklen_t length;
+	Timer timer;
+
+	if (!socketAddress(address, false, &storage, &length)) {
+		cout << "Error. Can't find " << what << " " << address << ", expected host:port or a socket path." << endl;
+		return -1;
+	}
+
+	while (true) {
+		int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+
+		if (fd < 0)
+			break;
+		if (!connect(fd, (sockaddr *) &storage, length)) {
+			noDelay(fd);
+			return fd;
+		}
+
+		close(fd);
+		if ((errno != ECONNREFUSED && errno != ENOENT) || timer.Seconds() > retrySeconds)
+			break;
+		this_thread::sleep_for(chrono::milliseconds(100));
+	}
+
+	cout << "Error. Can't reach " << what << " " << address << ": " << strerror(errno) << endl;
+	return -1;
+}
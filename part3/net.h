@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+using namespace std;
+
+/* Sockets shared by --listen/--worker and --serve. An address is host:port for TCP, or a */
+/* Unix socket path when it has a slash or no colon. Messages are int32s, and strings as a */
+/* length then bytes, in host byte order */
+
+/* host:port is TCP; anything with a slash or without a colon is a Unix socket path */
+bool localSocket(const char *address);
+
+/* Listening socket on address, replacing a stale Unix socket file but no other kind of file; */
+/* -1 with the error printed */
+int listenOn(const char *address);
+
+/* Connect to the what (for messages) at address, retrying for up to retrySeconds while it */
+/* isn't up yet; -1 with the error printed */
+int connectTo(const char *address, const char *what, int retrySeconds);
+
+/* Small messages shouldn't wait on Nagle. Fails harmlessly on Unix sockets */
+void noDelay(int fd);
+
+/* Make a send on fd fail after seconds without progress, so a peer that stops reading */
+/* can't block the sender for good */
+void sendTimeout(int fd, int seconds);
+
+/* Make a receive on fd fail after seconds without data, so a peer that stops sending */
+/* can't block the receiver for good */
+void receiveTimeout(int fd, int seconds);
+
+/* Whole buffers, retrying short reads and writes; false once the other end is gone */
+bool sendAll(int fd, const void *data, size_t size);
+bool receiveAll(int fd, void *data, size_t size);
+
+void appendInt(string *message, int32_t value);
+void appendString(string *message, const string &value);
+/* False if the peer goes away or sends a string longer than limit */
+bool receiveString(int fd, string *value, int32_t limit);
+
+/* Limits for receiveString */
+const int32_t MAX_ARGUMENT = 4096; /* an argument or path */
+const int32_t MAX_TEXT = 1 << 28; /* a scene's text, or what a render printed */
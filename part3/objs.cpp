@@ -1,11 +1,17 @@
 #include "objs.h"
 #include "Image.h"
+#include "debug.h"
+#include "profile.h"
+#include "lights.h"
+#include "random.h"
 #include <vector>
 #include <cmath>
 #include <iostream>
 #include <algorithm>
 using namespace std;
 
+thread_local long raysTraced = 0;
+
 /*                 *                Basic Geometry             *                 */
 
 Point::Point() {
@@ -102,8 +108,12 @@ Ray::Ray(Point *start, Vector *direction) {
 	this->direction = Vector(direction->x, direction->y, direction->z);
 }
 
-/* Constructor comes in handy during main pixel loop */
-Ray::Ray(int i, int j, int width, int height, Camera *camera) {
+/* Constructor comes in handy during main pixel loop, aims through the pixel center */
+Ray::Ray(int i, int j, int width, int height, Camera *camera) : Ray(i, j, 0.5, 0.5, width, height, camera) {
+}
+
+/* Aim through (dx, dy) inside pixel (i, j), both 0 -> 1 from its lower left corner */
+Ray::Ray(int i, int j, double dx, double dy, int width, int height, Camera *camera) {
 	float us, vs, ws, right, left, bottom, top;
 	start = Point(camera->center.x, camera->center.y, camera->center.z);
 	
@@ -112,8 +122,8 @@ Ray::Ray(int i, int j, int width, int height, Camera *camera) {
 	bottom = -1 * camera->up.magnitude / 2.0;
 	top = camera->up.magnitude / 2.0;
 
-	us = left + (right - left) * (i + 0.5) / (float) width;
-	vs = bottom + (top - bottom) * (j + 0.5) / (float) height;
+	us = left + (right - left) * (i + dx) / (float) width;
+	vs = bottom + (top - bottom) * (j + dy) / (float) height;
 	ws = -1;
 
 	/* Find, normalize new basis vectors */
@@ -198,6 +208,22 @@ Pigment Pigment::operator*(float scalar) {
 	return result;
 }
 
+/* Channel by channel, for light filtered through a colored object */
+Pigment Pigment::operator*(Pigment other) {
+	Pigment result = Pigment(r * other.r, g * other.g, b * other.b);
+
+	if (result.r > 255)
+		result.r = 255;
+
+	if (result.g > 255)
+		result.g = 255;
+
+	if (result.b > 255)
+		result.b = 255;
+
+	return result;
+}
+
 void Pigment::operator*=(float scalar) {
 	r *= scalar;
 	g *= scalar;
@@ -308,20 +334,81 @@ void Finish::Print() {
 
 /*            		*                  Scene Setup				    *               */
 
+Material::Material() {
+	pigment = Pigment();
+	finish = Finish();
+	ambient = diffuse = specular = Pigment();
+	shiny = 0;
+}
+
+Material::Material(Pigment *pigment, Finish *finish) {
+	this->pigment = *pigment;
+	this->finish = *finish;
+	ambient = Pigment(finish->ambient * pigment->r, finish->ambient * pigment->g, finish->ambient * pigment->b);
+	diffuse = Pigment(finish->diffuse * pigment->r, finish->diffuse * pigment->g, finish->diffuse * pigment->b);
+	specular = Pigment(finish->specular * pigment->r, finish->specular * pigment->g, finish->specular * pigment->b);
+	shiny = 1.0 / finish->roughness;
+}
+
+/* Return the index of a Material matching pigment and finish, adding one if it's new */
+int MaterialTable::Intern(Pigment *pigment, Finish *finish) {
+	string key = string((char *) pigment, sizeof(Pigment)) + string((char *) finish, sizeof(Finish));
+	unordered_map<string, int>::iterator found = index.find(key);
+
+	if (found != index.end())
+		return found->second;
+
+	materials.push_back(Material(pigment, finish));
+	index[key] = materials.size() - 1;
+	return materials.size() - 1;
+}
+
+Material *MaterialTable::Get(int index) {
+	return &materials[index];
+}
+
 Light::Light() {
 	center = Point();
-	pigment = Pigment();
+	fadeDistance = fadePower = 0;
+	radius = INFINITY;
+	rank = 0;
 }
 
 Light::Light(Point center, Pigment pigment) {
 	this->center = center;
 	this->pigment = pigment;
+	fadeDistance = fadePower = 0;
+	radius = INFINITY;
+	rank = 0;
 }
 
 /* Print Light in povray format */
 void Light::Print() {
 	cout << "light {<" << center.x << ", " << center.y << ", " << center.z << "> ";
-	cout << "color <" << pigment.r << ", " << pigment.g << ", " << pigment.b << ", " << pigment.f << ">}" << endl << endl;
+	cout << "color <" << pigment.r << ", " << pigment.g << ", " << pigment.b << ", " << pigment.f << ">";
+	if (fadeDistance && fadePower)
+		cout << " fade_distance " << fadeDistance << " fade_power " << fadePower;
+	cout << "}" << endl << endl;
+}
+
+/* POV-Ray's fade: 2 / (1 + (d / fade_distance) ^ fade_power), or no falloff at all */
+float Light::Attenuation(float distance) {
+	if (fadeDistance <= 0 || fadePower <= 0)
+		return 1;
+
+	return 2 / (1 + pow(distance / fadeDistance, fadePower));
+}
+
+/* Solve Attenuation(radius) * brightest channel == cutoff */
+void Light::SetRadius(float cutoff) {
+	float brightest = max(pigment.r, max(pigment.g, pigment.b));
+
+	if (fadeDistance <= 0 || fadePower <= 0 || cutoff <= 0)
+		radius = INFINITY;
+	else if (2 * brightest <= cutoff)
+		radius = 0;
+	else
+		radius = fadeDistance * pow(2 * brightest / cutoff - 1, 1 / fadePower);
 }
 
 Camera::Camera() {
@@ -352,16 +439,32 @@ void Camera::Print() {
 
 
 
-/*            		 *                  Geometry				    *                  */
+BounceLimits::BounceLimits() {
+	maxDepth = 5;
+	minThroughput = 0;
+}
 
-Geometry::Geometry() {
+HitRecord::HitRecord() {
+	onGeom = Point();
 	normal = Vector();
-	pigment = Pigment();
-	truePigment = Pigment();
 	pigmentA = Pigment();
 	pigmentD = Pigment();
 	pigmentS = Pigment();
-	finish = Finish();
+	truePigment = Pigment();
+}
+
+/*            		 *                  Geometry				    *                  */
+
+Geometry::Geometry() {
+	materials = NULL;
+	material = 0;
+	line = 0;
+	index = 0;
+	bounceLimits = NULL;
+}
+
+Material *Geometry::GetMaterial() {
+	return materials->Get(material);
 }
 
 /* Virtual function, should not be called */
@@ -373,6 +476,10 @@ void Geometry::PrintType() {
 	cout << "Geometry" << endl;
 }
 
+const char *Geometry::TypeName() {
+	return "geometry";
+}
+
 /* Virtual function, should not be called */
 float Geometry::Intersect(int i, int j, Ray *ray) {
 	cout << "Geometry object intersect." << endl;
@@ -380,187 +487,408 @@ float Geometry::Intersect(int i, int j, Ray *ray) {
 }
 
 /* Set Point on Geometry itself, along initial Ray from camera */
-void Geometry::SetOnGeom(Ray *ray, float rayDistance) {
-	onGeom.x = ray->start.x + rayDistance * ray->direction.x;
-	onGeom.y = ray->start.y + rayDistance * ray->direction.y;
-	onGeom.z = ray->start.z + rayDistance * ray->direction.z;
+void Geometry::SetOnGeom(Ray *ray, float rayDistance, HitRecord *record) {
+	record->onGeom.x = ray->start.x + rayDistance * ray->direction.x;
+	record->onGeom.y = ray->start.y + rayDistance * ray->direction.y;
+	record->onGeom.z = ray->start.z + rayDistance * ray->direction.z;
 }
 
-void Geometry::SetNormal() {
+void Geometry::SetNormal(HitRecord *record) {
 	;
 }
 
 /* Virtual function, should not be called */
-Pigment Geometry::BlinnPhong(int i, int j, Ray *ray, float rayDist) {
+Pigment Geometry::BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record) {
 	cout << "Geometry object Blinn Phong." << endl;
 	return Pigment(0, 0, 0);
 }
 
-/* Find Ambient Pigment for Blinn Phong */
-void Geometry::BlinnPhongAmbient() {
-	Pigment cappedLight = Pigment(light->pigment.r, light->pigment.g, light->pigment.b);
-	if (cappedLight.r > 1)
-		cappedLight.r = 1;
+/* Virtual function, should not be called */
+void Geometry::SetSurface(Ray *ray, float rayDist, HitRecord *record) {
+	cout << "Geometry object SetSurface." << endl;
+}
 
-	if (cappedLight.g > 1)
-		cappedLight.g = 1;
+/* Whether BlinnPhong adds a specular term for this kind of object */
+bool Geometry::Specular() {
+	return false;
+}
 
-	if (cappedLight.b > 1)
-		cappedLight.b = 1;
+/* Append the numbers that define this object's position and shape, for hashing */
+void Geometry::AppendShape(vector<float> *shape) {
+}
 
-	pigmentA.r = finish.ambient * pigment.r * cappedLight.r;
-	pigmentA.g = finish.ambient * pigment.g * cappedLight.g;
-	pigmentA.b = finish.ambient * pigment.b * cappedLight.b;
+/* Outward (for triangles, front facing) unit normal at point */
+Vector Geometry::NormalAt(Point *point) {
+	return Vector();
+}
 
-	truePigment += &pigmentA;
+/* Find Ambient Pigment for Blinn Phong, lit by every light's color (capped at 1) */
+void Geometry::BlinnPhongAmbient(HitRecord *record) {
+	Material *m = GetMaterial();
+
+	record->pigmentA.r = m->ambient.r * lights->ambient.r;
+	record->pigmentA.g = m->ambient.g * lights->ambient.g;
+	record->pigmentA.b = m->ambient.b * lights->ambient.b;
+
+	record->truePigment += &record->pigmentA;
 }
 
-/* Find Diffuse Pigment for Blinn Phong */
-void Geometry::BlinnPhongDiffuse() {
+/* Add one light's Diffuse Pigment for Blinn Phong, lightVector is normalized */
+/* scale is the light's attenuation, divided by its pdf when lights are sampled */
+void Geometry::BlinnPhongDiffuse(Light *light, Vector *lightVector, float scale, HitRecord *record) {
 	float zero = 0;
-	Vector lightVector = Vector(light->center.x - onGeom.x, light->center.y - onGeom.y, light->center.z - onGeom.z);
-	lightVector.Normalize();
+	Pigment diffuse;
+	Material *m = GetMaterial();
 
-	pigmentD.r = finish.diffuse * pigment.r * light->pigment.r * max(normal.Dot(&lightVector), zero);
-	pigmentD.g = finish.diffuse * pigment.g * light->pigment.g * max(normal.Dot(&lightVector), zero);
-	pigmentD.b = finish.diffuse * pigment.b * light->pigment.b * max(normal.Dot(&lightVector), zero);
+	diffuse.r = m->diffuse.r * light->pigment.r * max(record->normal.Dot(lightVector), zero) * scale;
+	diffuse.g = m->diffuse.g * light->pigment.g * max(record->normal.Dot(lightVector), zero) * scale;
+	diffuse.b = m->diffuse.b * light->pigment.b * max(record->normal.Dot(lightVector), zero) * scale;
 
-	pigmentD *= 1 - finish.reflect;
-	//pigmentD *= 1 - pigment.f;
+	diffuse *= 1 - m->finish.reflect;
+	//diffuse *= 1 - pigment.f;
 
-	truePigment += pigmentD;
+	record->pigmentD += diffuse;
+	record->truePigment += diffuse;
 }
 
-/* Find Specular Pigment for Blinn Phong */
-void Geometry::BlinnPhongSpecular() {
+/* Add one light's Specular Pigment for Blinn Phong, lightVector is normalized */
+void Geometry::BlinnPhongSpecular(Light *light, Vector *lightVector, float scale, HitRecord *record) {
 	float zero = 0;
-	Vector lightVector = Vector(light->center.x - onGeom.x, light->center.y - onGeom.y, light->center.z - onGeom.z);
-	Vector view = Vector(camera->center.x - onGeom.x, camera->center.y - onGeom.y, camera->center.z - onGeom.z);
+	Pigment specular;
+	Material *m = GetMaterial();
+	Point *onGeom = &record->onGeom;
+	Vector view = Vector(camera->center.x - onGeom->x, camera->center.y - onGeom->y, camera->center.z - onGeom->z);
 
-	lightVector.Normalize();
 	view.Normalize();
 
-	Vector half = Vector(view.x + lightVector.x, view.y + lightVector.y, view.z + lightVector.z);
+	Vector half = Vector(view.x + lightVector->x, view.y + lightVector->y, view.z + lightVector->z);
 	half.Normalize();
 
-	float shiny = 1.0/finish.roughness;
+	specular.r = m->specular.r * light->pigment.r * pow(max(half.Dot(&record->normal), zero), m->shiny) * scale;
+	specular.g = m->specular.g * light->pigment.g * pow(max(half.Dot(&record->normal), zero), m->shiny) * scale;
+	specular.b = m->specular.b * light->pigment.b * pow(max(half.Dot(&record->normal), zero), m->shiny) * scale;
+
+	record->pigmentS += &specular;
+	record->truePigment += &specular;
+}
+
+/* Add Diffuse (and Specular) Pigments from every light that reaches onGeom unshadowed */
+/* Only lights the LightTree says are in range are looked at, so cost follows nearby lights */
+void Geometry::BlinnPhongLights(int i, int j, bool specular, HitRecord *record) {
+	static thread_local vector<Light *> nearby;
+	Point *onGeom = &record->onGeom;
+
+	record->pigmentD = Pigment();
+	record->pigmentS = Pigment();
+
+	nearby.clear();
+	lights->Query(onGeom, &nearby);
+
+	if (lights->samples && nearby.size() > lights->samples) {
+		BlinnPhongSampledLights(i, j, specular, &nearby, record);
+		return;
+	}
+
+	for (int l = 0; l < nearby.size(); l++) {
+		Light *light = nearby[l];
+		Vector lightVector = Vector(light->center.x - onGeom->x, light->center.y - onGeom->y, light->center.z - onGeom->z);
+		float distance = lightVector.magnitude;
+		lightVector.Normalize();
+
+		/* Facing away gives no diffuse, and a closed surface shadows itself anyway, so skip the feeler */
+		if (record->normal.Dot(&lightVector) <= 0 || !ShadowFeeler(i, j, light, record))
+			continue;
 
-	pigmentS.r = finish.specular * pigment.r * light->pigment.r * pow(max(half.Dot(&normal), zero), shiny);
-	pigmentS.g = finish.specular * pigment.g * light->pigment.g * pow(max(half.Dot(&normal), zero), shiny);
-	pigmentS.b = finish.specular * pigment.b * light->pigment.b * pow(max(half.Dot(&normal), zero), shiny);
+		BlinnPhongDiffuse(light, &lightVector, light->Attenuation(distance), record);
+		if (specular)
+			BlinnPhongSpecular(light, &lightVector, light->Attenuation(distance), record);
+	}
+}
+
+/* Stochastic version for many nearby lights: weight each by its unshadowed diffuse estimate */
+/* (color * attenuation * N.L), draw lights->samples of them from an alias table and scale */
+/* each by 1 / (samples * pdf). Shadow feelers, the expensive part, no longer grow with light count */
+void Geometry::BlinnPhongSampledLights(int i, int j, bool specular, vector<Light *> *nearby, HitRecord *record) {
+	static thread_local vector<float> weights;
+	static thread_local AliasTable table;
+	Point *onGeom = &record->onGeom;
+	float pdf;
+
+	weights.clear();
+	for (int l = 0; l < nearby->size(); l++) {
+		Light *light = nearby->at(l);
+		Vector lightVector = Vector(light->center.x - onGeom->x, light->center.y - onGeom->y, light->center.z - onGeom->z);
+		float distance = lightVector.magnitude;
+		lightVector.Normalize();
+
+		float power = light->pigment.r + light->pigment.g + light->pigment.b;
+		weights.push_back(max(record->normal.Dot(&lightVector), 0.0f) * power * light->Attenuation(distance));
+	}
+
+	table.Build(&weights);
+
+	for (int s = 0; s < lights->samples; s++) {
+		float u1 = shadingRandom.Uniform(), u2 = shadingRandom.Uniform();
+		Light *light = nearby->at(table.Sample(u1, u2, &pdf));
+		Vector lightVector = Vector(light->center.x - onGeom->x, light->center.y - onGeom->y, light->center.z - onGeom->z);
+		float distance = lightVector.magnitude;
+		lightVector.Normalize();
 
-	truePigment += &pigmentS;
+		/* pdf is 0 only when every weight was, i.e. nothing faces this point */
+		if (pdf <= 0 || !ShadowFeeler(i, j, light, record))
+			continue;
+
+		float scale = light->Attenuation(distance) / (lights->samples * pdf);
+		BlinnPhongDiffuse(light, &lightVector, scale, record);
+		if (specular)
+			BlinnPhongSpecular(light, &lightVector, scale, record);
+	}
 }
 
 /* Send Shadow Feeler ray from current geometry */
 /* Return boolean that determines if another object blocks the light source from current object */
-bool Geometry::ShadowFeeler(int i, int j) {
+bool Geometry::ShadowFeeler(int i, int j, Light *light, HitRecord *record) {
+	return lightVisible(allGeometry, i, j, &record->onGeom, light);
+}
+
+/* True when nothing in allGeometry lies between from and light; touches no object state, */
+/* so any thread may call it */
+bool lightVisible(vector<Geometry *> *allGeometry, int i, int j, Point *from, Light *light) {
 	float dist = 0;
-	float lightDistance = onGeom.Distance(&light->center);
+	float lightDistance = from->Distance(&light->center);
 
-	Vector feelVector = Vector(light->center.x - onGeom.x, light->center.y - onGeom.y, light->center.z - onGeom.z);
+	Vector feelVector = Vector(light->center.x - from->x, light->center.y - from->y, light->center.z - from->z);
 	feelVector.Normalize();
-	feeler = Ray(&onGeom, &feelVector);
+	Ray feeler = Ray(from, &feelVector);
+	raysTraced++;
+
+	ObjectCost *costs = profileCosts();
 
 	for (int geom = 0; geom < allGeometry->size(); geom++) {
-		dist = allGeometry->at(geom)->Intersect(i, j, &feeler);
+		Geometry *other = allGeometry->at(geom);
+
+		if (costs) {
+			uint64_t start = profileClock(), ticks;
+			dist = other->Intersect(i, j, &feeler);
+			ticks = profileClock() - start;
+			costs[geom].intersectTicks += ticks;
+			costs[geom].tested++;
+			feelerTicks += ticks;
+		}
+		else
+			dist = other->Intersect(i, j, &feeler);
 
 		/* if object with positive distance is closer than light source */
-		if (dist > 0.001 && dist < lightDistance)
+		if (dist > 0.001 && dist < lightDistance) {
+			if (costs)
+				costs[geom].occlusions++;
 			return false; /* Don't color pixel */
+		}
 	}
 
 	return true;
 }
 
-/* Reset pigments for next Blinn Phong */
-void Geometry::ResetPigments() {
-	pigmentA = Pigment();
-	pigmentD = Pigment();
-	pigmentS = Pigment();
+/* BlinnPhong, timed into this object's cost when profiling. The shadow feelers it sends */
+/* are already counted against the objects they test, so their time is taken back out */
+void Geometry::Shade(int i, int j, Ray *ray, float rayDist, HitRecord *record) {
+	ObjectCost *costs = profileCosts();
+
+	if (costs) {
+		uint64_t start = profileClock(), feelers = feelerTicks;
+		BlinnPhong(i, j, ray, rayDist, record);
+		costs[index].shadeTicks += profileClock() - start - (feelerTicks - feelers);
+	}
+	else
+		BlinnPhong(i, j, ray, rayDist, record); /* record->truePigment holds result of this->BlinnPhong */
 }
 
-Pigment Geometry::Reflect(int i, int j, float rayDist, Ray ray, int bounce) {		
-	BlinnPhong(i, j, &ray, rayDist); /* truePigment holds result of this->BlinnPhong */
+/* Bend incident through surface into an object of index ior, or back out if it is leaving */
+/* Fills refracted and returns the Schlick approximation of the Fresnel reflectance, */
+/* or returns 1 without touching refracted on total internal reflection */
+float refractRay(Ray *incident, Point *surface, Vector *normal, float ior, Ray *refracted) {
+	Vector d = Vector(incident->direction.x, incident->direction.y, incident->direction.z);
+	Vector n = Vector(normal->x, normal->y, normal->z);
+	d.Normalize();
 
-	if (i == 320 && j == 145) {
-		cout << "Ambient: " << to_string(pigmentA.r) << ", " << to_string(pigmentA.g) << ", " << to_string(pigmentA.b) << endl;
-		cout << "Diffuse: " << to_string(pigmentD.r) << ", " << to_string(pigmentD.g) << ", " << to_string(pigmentD.b) << endl;
-		cout << "Specular: " << to_string(pigmentS.r) << ", " << to_string(pigmentS.g) << ", " << to_string(pigmentS.b) << endl;
-	}
+	float cosI = -d.Dot(&n), eta = 1 / ior;
 
-	/* If we have hit max bounces, or what we've hit isn't reflective, return its color */
-	// thumbs up
-	if (bounce > 4 || !finish.reflect) {
-		return truePigment;
+	/* Leaving the object, flip the normal to the side we're on */
+	if (cosI < 0) {
+		n *= -1;
+		cosI = -cosI;
+		eta = ior;
 	}
 
-	else {
-		/* Compute reflected ray */
-		Ray reflectRay = Ray(&ray, &onGeom, &normal);
+	float sin2T = eta * eta * (1 - cosI * cosI);
+	if (sin2T > 1)
+		return 1;
+
+	float cosT = sqrt(1 - sin2T);
+	Vector direction = Vector(eta * d.x + (eta * cosI - cosT) * n.x, eta * d.y + (eta * cosI - cosT) * n.y, eta * d.z + (eta * cosI - cosT) * n.z);
+	*refracted = Ray(surface, &direction);
+
+	/* Schlick uses the angle on the less dense side */
+	float r0 = (1 - ior) / (1 + ior), c = 1 - (eta > 1 ? cosT : cosI);
+	r0 *= r0;
+	return r0 + (1 - r0) * c * c * c * c * c;
+}
+
+/* One level of a ray chain, kept until the deeper color is known */
+class Bounce {
+public:
+	Pigment local; /* ambient + (1 - reflect - filter) * (diffuse + specular) */
+	Pigment weight; /* what the deeper color is scaled by */
+	RayNode *node;
+};
+
+/* Shade this Geometry at rayDist along ray, then follow reflections and refractions in a loop */
+/* finalColor = ambient + (1 - reflect - filter) * (diffuse + specular) + (reflect + filter * F) * reflected */
+/* + filter * (1 - F) * pigment * refracted, F being the Fresnel reflectance and filter the pigment's */
+/* f when the finish has refraction. Where both branches matter only one is followed, picked in */
+/* proportion to its weight and scaled by 1 / probability, so glass costs one ray per bounce */
+/* instead of doubling. The stack is applied innermost first once the chain ends at a */
+/* non-reflective object, a miss, maxDepth, or when its weight in the pixel drops below minThroughput. */
+/* One HitRecord serves the whole chain, each bounce's local terms are saved before the next */
+Pigment Geometry::Reflect(int i, int j, float rayDist, Ray *ray, RayNode *node, int maxDepth) {
+	Bounce stack[MAX_DEPTH];
+	int depth = 0;
+	float throughput = 1;
+	Geometry *geom = this;
+	Ray current = *ray;
+	HitRecord record;
+	Pigment result;
+
+	while (true) {
+		geom->Shade(i, j, &current, rayDist, &record);
+
+		if (node)
+			node->SetShading(geom, rayDist, &record.pigmentA, &record.pigmentD, &record.pigmentS);
+
+		Material *m = geom->GetMaterial();
+		float reflect = m->finish.reflect, filter = 0, fresnel = 1;
+		bool inside = false;
+		Ray refracted;
+
+		if (m->finish.refract && m->pigment.f) {
+			filter = m->finish.refract * m->pigment.f;
+			inside = current.direction.Dot(&record.normal) > 0;
+			fresnel = refractRay(&current, &record.onGeom, &record.normal, m->finish.ior ? m->finish.ior : 1, &refracted);
+
+			/* Light was filtered on the way in; on the way out it is only split by Fresnel */
+			if (inside) {
+				reflect = 0;
+				filter = 1;
+			}
+		}
+
+		float reflectWeight = reflect + filter * fresnel, refractWeight = filter * (1 - fresnel);
+		float total = reflectWeight + refractWeight;
 
-		if (i == 320 && j == 145) {
-			cout << "----" << endl << "Iteration type: Reflection" << endl;
-			reflectRay.PrintTest();
+		/* Last bounce, or what we've hit doesn't pass on enough light to matter: use its full color */
+		/* The inside of a refractive object has no color of its own */
+		if (!total || depth >= maxDepth || throughput * total < bounceLimits->minThroughput) {
+			result = inside ? Pigment() : record.truePigment;
+			break;
 		}
 
-		float newDistance, closest = 10000;
-		Geometry *hitGeometry;
-		
-		/* From current geometry, send reflect ray towards other geometry */
-		for (int g = 0; g < allGeometry->size(); g++) {
-			newDistance = allGeometry->at(g)->Intersect(i, j, &reflectRay);
-			if (newDistance > 0.001 && newDistance < closest) { //distance > 0.001 && distance < storage.distance
-				closest = newDistance;
-				hitGeometry = allGeometry->at(g);
-			}
+		/* Local terms are saved now, the next hit overwrites them */
+		Bounce *bounce = &stack[depth++];
+		bounce->local = inside ? Pigment() : record.pigmentA + (record.pigmentS + record.pigmentD) * max(1 - reflect - filter, 0.0f);
+		bounce->weight = Pigment(total, total, total);
+		bounce->node = node;
+		throughput *= total;
+
+		/* Only draw a random number when there is a choice to make */
+		bool refract = refractWeight > 0 && (reflectWeight <= 0 || shadingRandom.Uniform() * total < refractWeight);
+
+		/* Compute the next ray and send it towards other geometry */
+		if (refract) {
+			current = refracted;
+			if (!inside)
+				bounce->weight = bounce->weight * m->pigment;
+		}
+		else
+			current = Ray(&current, &record.onGeom, &record.normal);
+		raysTraced++;
+
+		if (node) {
+			RayNode *child = new RayNode(refract ? "refraction" : "reflection", &current);
+			node->children.push_back(child);
+			node = child;
 		}
 
-		/* We didn't hit new geometry after reflecting, what to do? */
-		if (closest == 10000)
-			return (pigmentS + pigmentD) * (1 - finish.reflect) + pigmentA; //we add the pigment of current reflective object and ambient light
+		rayDist = 10000;
+		geom = closestHit(allGeometry, i, j, &current, &rayDist);
 
-		if (i == 320 and j == 145) {
-			cout << "1 - finish.reflect: " << 1 - finish.reflect << endl;
-			truePigment.Print();
+		/* Went off into nothing, only the local terms count */
+		if (!geom) {
+			result = Pigment();
+			break;
 		}
+	}
+
+	if (node && geom)
+		node->color = result;
 
-		/* finalColor = 1.0*local_ambient + (1-reflect-filt)*(diffuse+specular) + reflect*(reflected_color)+filt*refracted_color; */
+	while (depth--) {
+		Bounce *bounce = &stack[depth];
+		result = bounce->local + result * bounce->weight;
 
-		/* Call Reflect from new hit Geometry */
-		/* return this pigment offset by leftover reflective qualities + hit object pigment * reflective qualities */
-		//     truePigment * (1 - finish.reflect)
-		return pigmentA + (pigmentS + pigmentD) * (1 - finish.reflect) + hitGeometry->Reflect(i, j, closest, reflectRay, bounce + 1) * finish.reflect;
+		if (bounce->node)
+			bounce->node->color = result;
 	}
+
+	return result;
 }
 
+/* Shared by primary and reflection rays; the profiling branch is only taken when costs were allocated */
+Geometry *closestHit(vector<Geometry *> *allGeometry, int i, int j, Ray *ray, float *distance) {
+	Geometry *hit = NULL;
+	ObjectCost *costs = profileCosts();
+	float newDistance;
+
+	for (int g = 0; g < allGeometry->size(); g++) {
+		Geometry *geom = allGeometry->at(g);
+
+		if (costs) {
+			uint64_t start = profileClock();
+			newDistance = geom->Intersect(i, j, ray);
+			costs[g].intersectTicks += profileClock() - start;
+			costs[g].tested++;
+		}
+		else
+			newDistance = geom->Intersect(i, j, ray);
+
+		if (newDistance > 0.001 && newDistance < *distance) {
+			*distance = newDistance;
+			hit = geom;
+		}
+	}
+
+	if (hit && costs)
+		costs[hit->index].hits++;
+
+	return hit;
+}
 
 Sphere::Sphere() {
 	center = Point();
-	onGeom = Point();
 	radius = 0;
-	normal = Vector();
-	pigment = Pigment();
-	pigmentA = Pigment();
-	pigmentD = Pigment();
-	pigmentS = Pigment();
-	finish = Finish();
 }
 
-Sphere::Sphere(Point *center, float radius, Pigment *pigment, Finish *finish) {
+Sphere::Sphere(Point *center, float radius, int material) {
 	this->center = Point(center->x, center->y, center->z);
 	this->radius = radius;
-	this->pigment = Pigment(pigment->r, pigment->g, pigment->b, pigment->f);
-	this->finish = Finish(finish->ambient, finish->diffuse, finish->specular, finish->roughness, finish->reflect, finish->refract, finish->ior);
-	pigmentA = Pigment();
-	pigmentD = Pigment();
-	pigmentS = Pigment();
-	onGeom = Point();
+	this->material = material;
 }
 
 /* Print sphere in povray format */
 // float ambient, diffuse, specular, roughness, reflect, refract, ior;
 void Sphere::Print() {
+	Pigment pigment = GetMaterial()->pigment;
+	Finish finish = GetMaterial()->finish;
+
 	cout << "sphere { ";
 	cout << "<" << center.x << ", " << center.y << ", " << center.z << ">, " << radius << endl;
 	cout << "  pigment { color <" << pigment.r << ", " << pigment.g << ", " << pigment.b << ", " << pigment.f << ">}" << endl;
@@ -576,7 +904,6 @@ void Sphere::Print() {
 	if (finish.ior)
 		cout << " ior " << finish.ior;
 	cout << "}" << endl;
-	cout << "  onGeom <" << onGeom.x << ", " << onGeom.y << ", " << onGeom.z << ">" << endl;
 	cout << "}" << endl;
 }
 
@@ -584,6 +911,10 @@ void Sphere::PrintType() {
 	cout << "Sphere" << endl;
 }
 
+const char *Sphere::TypeName() {
+	return "sphere";
+}
+
  /* Return distance from point along ray to sphere */
 float Sphere::Intersect(int i, int j, Ray *ray) {
 	float distance, t1, t2, rad;
@@ -618,52 +949,62 @@ float Sphere::Intersect(int i, int j, Ray *ray) {
 	return distance;
 }
 
-void Sphere::SetNormal() {
-	normal = Vector((onGeom.x - center.x)/radius, (onGeom.y - center.y)/radius, (onGeom.z - center.z)/radius);
-	normal.Normalize();
+void Sphere::SetNormal(HitRecord *record) {
+	Point *onGeom = &record->onGeom;
+
+	record->normal = Vector((onGeom->x - center.x)/radius, (onGeom->y - center.y)/radius, (onGeom->z - center.z)/radius);
+	record->normal.Normalize();
 }
 
 /* Blinn Phong BRDF for Sphere object */
-Pigment Sphere::BlinnPhong(int i, int j, Ray *ray, float rayDist) {
-	truePigment = Pigment(0, 0, 0);
-	SetOnGeom(ray, rayDist);
-	SetNormal();
-	BlinnPhongAmbient();
-	bool noShadow = ShadowFeeler(i, j);
-
-	/* If current point on sphere is not in shadow, add Diffuse and Specular Pigments */
-	if (noShadow) {
-		BlinnPhongDiffuse();
-		BlinnPhongSpecular();
-	}
+Pigment Sphere::BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record) {
+	record->truePigment = Pigment(0, 0, 0);
+	SetSurface(ray, rayDist, record);
+	BlinnPhongAmbient(record);
+
+	/* Add Diffuse and Specular Pigments for each light this point on the sphere can see */
+	BlinnPhongLights(i, j, true, record);
+
+	return record->truePigment;
+}
 
-	return truePigment;
+/* Fill in record's onGeom and normal for the hit rayDist along ray */
+void Sphere::SetSurface(Ray *ray, float rayDist, HitRecord *record) {
+	SetOnGeom(ray, rayDist, record);
+	SetNormal(record);
+}
+
+bool Sphere::Specular() {
+	return true;
+}
+
+Vector Sphere::NormalAt(Point *point) {
+	Vector result = Vector((point->x - center.x)/radius, (point->y - center.y)/radius, (point->z - center.z)/radius);
+	result.Normalize();
+	return result;
+}
+
+void Sphere::AppendShape(vector<float> *shape) {
+	float values[4] = {center.x, center.y, center.z, radius};
+	shape->insert(shape->end(), values, values + 4);
 }
 
 Plane::Plane() {
 	normal = Vector();
-	onGeom = Point();
 	distance = 0;
-	pigment = Pigment();
-	pigmentA = Pigment();
-	pigmentD = Pigment();
-	pigmentS = Pigment();
-	finish = Finish();
 }
 
-Plane::Plane(Vector *normal, float distance, Pigment *pigment, Finish *finish) {
+Plane::Plane(Vector *normal, float distance, int material) {
 	this->normal = Vector(normal->x, normal->y, normal->z);
 	this->distance = distance;
-	this->pigment = Pigment(pigment->r, pigment->g, pigment->b, pigment->f);
-	this->finish = Finish(finish->ambient, finish->diffuse, finish->specular, finish->roughness, finish->reflect, finish->refract, finish->ior);
-	pigmentA = Pigment();
-	pigmentD = Pigment();
-	pigmentS = Pigment();
-	onGeom = Point();
+	this->material = material;
 }
 
 /* Print plane in povray format */
 void Plane::Print() {
+	Pigment pigment = GetMaterial()->pigment;
+	Finish finish = GetMaterial()->finish;
+
 	cout << "plane {";
 	cout << "<" << normal.x << ", " << normal.y << ", " << normal.z << ">, " << distance << endl;
 	cout << "  pigment {color <" << pigment.r << ", " << pigment.g << ", " << pigment.b << ", " << pigment.f << ">}" << endl;
@@ -686,20 +1027,20 @@ void Plane::PrintType() {
 	cout << "Plane" << endl;
 }
 
-/* Initialize point on plane according to povray info */
-/* Useful when parsing, otherwise use Geometry::SetOnGeom */
-void Plane::SetOnGeom() {
-	onGeom.x = distance * normal.x;
-	onGeom.y = distance * normal.y;
-	onGeom.z = distance * normal.z;
+const char *Plane::TypeName() {
+	return "plane";
+}
+
+/* Initialize point on plane according to povray info, once parsed */
+void Plane::SetPoint() {
+	point = Point(distance * normal.x, distance * normal.y, distance * normal.z);
 }
 
 /* Return distance from point along ray to plane */
 float Plane::Intersect(int i, int j, Ray *ray) {
 	float distance;
 	Vector rayD = Vector(ray->direction.x, ray->direction.y, ray->direction.z);
-	//Vector difObjectPlane = Vector(onGeom.x - point->x, onGeom.y - point->y, onGeom.z - point->z);
-	Vector difObjectPlane = Vector(onGeom.x - ray->start.x, onGeom.y - ray->start.y, onGeom.z - ray->start.z);
+	Vector difObjectPlane = Vector(point.x - ray->start.x, point.y - ray->start.y, point.z - ray->start.z);
 
 	/* If dot product is 0, return no hit */
 	if (rayD.Dot(&normal) == 0)
@@ -711,19 +1052,30 @@ float Plane::Intersect(int i, int j, Ray *ray) {
 }
 
 /* Blinn Phong BRDF for plane object */
-Pigment Plane::BlinnPhong(int i, int j, Ray *ray, float rayDist) {
-	Geometry::SetOnGeom(ray, rayDist);
-	truePigment = Pigment(0, 0, 0);
-	BlinnPhongAmbient();
+Pigment Plane::BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record) {
+	SetSurface(ray, rayDist, record);
+	record->truePigment = Pigment(0, 0, 0);
+	BlinnPhongAmbient(record);
 
-	bool noShadow = ShadowFeeler(i, j);
+	/* Add Diffuse Pigment for each light this point on the plane can see */
+	BlinnPhongLights(i, j, false, record);
 
-	/* If current point on plane is not in shadow, add Diffuse Pigment */
-	if (noShadow) {
-		BlinnPhongDiffuse();
-	}
+	return record->truePigment;
+}
 
-	return truePigment;
+/* The normal never changes, only the point does */
+void Plane::SetSurface(Ray *ray, float rayDist, HitRecord *record) {
+	SetOnGeom(ray, rayDist, record);
+	record->normal = normal;
+}
+
+Vector Plane::NormalAt(Point *point) {
+	return normal;
+}
+
+void Plane::AppendShape(vector<float> *shape) {
+	float values[4] = {normal.x, normal.y, normal.z, distance};
+	shape->insert(shape->end(), values, values + 4);
 }
 
 Triangle::Triangle() {
@@ -732,13 +1084,6 @@ Triangle::Triangle() {
 	vertexC = Point();
 	AB = Vector();
 	AC = Vector();
-	normal = Vector();
-	onGeom = Point();
-	pigment = Pigment();
-	pigmentA = Pigment();
-	pigmentD = Pigment();
-	pigmentS = Pigment();
-	finish = Finish();
 }
 
 Triangle::Triangle(Point *vertexA, Point *vertexB, Point *vertexC) {
@@ -746,19 +1091,12 @@ Triangle::Triangle(Point *vertexA, Point *vertexB, Point *vertexC) {
 	this->vertexB = Point(vertexB->x, vertexB->y, vertexB->z);
 	this->vertexC = Point(vertexC->x, vertexC->y, vertexC->z);
 	SetVectors();
-	normal = Vector();
-	AB.Cross(&AC, &normal);
-	normal.Normalize();
-
-	onGeom = Point();
-	pigment = Pigment();
-	pigmentA = Pigment();
-	pigmentD = Pigment();
-	pigmentS = Pigment();
-	finish = Finish();	
 }
 
 void Triangle::Print() {
+	Pigment pigment = GetMaterial()->pigment;
+	Finish finish = GetMaterial()->finish;
+
 	cout << "triangle {" << endl << "   ";
 	vertexA.Print();
 	cout << "   ";
@@ -776,17 +1114,21 @@ void Triangle::PrintType() {
 	cout << "Triangle" << endl;
 }
 
+const char *Triangle::TypeName() {
+	return "triangle";
+}
+
 void Triangle::SetVectors() {
 	AB = Vector(vertexA.x - vertexB.x, vertexA.y - vertexB.y, vertexA.z - vertexB.z);
 	AC = Vector(vertexA.x - vertexC.x, vertexA.y - vertexC.y, vertexA.z - vertexC.z);
 }
 
-void Triangle::SetNormal(Ray *ray) {
-	AB.Cross(&AC, &normal);
-	normal.Normalize();
+void Triangle::SetNormal(Ray *ray, HitRecord *record) {
+	AB.Cross(&AC, &record->normal);
+	record->normal.Normalize();
 
-	if (ray->direction.Dot(&normal) > 0)
-		normal *= -1;
+	if (ray->direction.Dot(&record->normal) > 0)
+		record->normal *= -1;
 }
 
 float Triangle::Intersect(int i, int j, Ray *ray) {
@@ -827,20 +1169,33 @@ float Triangle::Intersect(int i, int j, Ray *ray) {
 		return -1;
 }
 
-Pigment Triangle::BlinnPhong(int i, int j, Ray *ray, float rayDist) {
-	truePigment = Pigment(0, 0, 0);
-	SetOnGeom(ray, rayDist);
-	SetNormal(ray);
-	BlinnPhongAmbient();
+Pigment Triangle::BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record) {
+	record->truePigment = Pigment(0, 0, 0);
+	SetSurface(ray, rayDist, record);
+	BlinnPhongAmbient(record);
 
-	bool noShadow = ShadowFeeler(i, j);
+	/* Add Diffuse Pigment for each light this point on the triangle can see */
+	BlinnPhongLights(i, j, false, record);
 
-	/* If current point on triangle is not in shadow, add Diffuse Pigment */
-	if (noShadow) {
-		BlinnPhongDiffuse();
-	}
+	return record->truePigment;
+}
 
-	return truePigment;
+/* Normal is flipped to face the ray, triangles are two sided */
+void Triangle::SetSurface(Ray *ray, float rayDist, HitRecord *record) {
+	SetOnGeom(ray, rayDist, record);
+	SetNormal(ray, record);
+}
+
+Vector Triangle::NormalAt(Point *point) {
+	Vector result;
+	AB.Cross(&AC, &result);
+	result.Normalize();
+	return result;
+}
+
+void Triangle::AppendShape(vector<float> *shape) {
+	float values[9] = {vertexA.x, vertexA.y, vertexA.z, vertexB.x, vertexB.y, vertexB.z, vertexC.x, vertexC.y, vertexC.z};
+	shape->insert(shape->end(), values, values + 9);
 }
 
 
@@ -849,7 +1204,6 @@ Pigment Triangle::BlinnPhong(int i, int j, Ray *ray, float rayDist) {
 /* 				   *				Storage						*				  */
 Storage::Storage() {
 	distance = 0;
-	pigment = Pigment();
 }
 
 Storage::Storage(float distance, Pigment *pigment) {
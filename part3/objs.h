@@ -1,6 +1,8 @@
 #pragma once
 #include "Image.h"
 #include <vector>
+#include <string>
+#include <unordered_map>
 using namespace std;
 
 class Point {
@@ -31,6 +33,7 @@ public:
 	Ray();
 	Ray(Point *start, Vector *direction);
 	Ray(int i, int j, int width, int height, class Camera *camera);
+	Ray(int i, int j, double dx, double dy, int width, int height, class Camera *camera);
 	Ray(Ray *initial, Point *intersect, Vector *normal);
 	void Print();
 	void PrintTest();
@@ -38,6 +41,9 @@ public:
 	Vector direction;
 };
 
+/* Rays cast by the current thread (primary, reflection and shadow), read by the perf report */
+extern thread_local long raysTraced;
+
 /* Used for rgb or rgbf colors */
 class Pigment {
 public:
@@ -48,6 +54,7 @@ public:
 	void operator+=(Pigment other);
 	void operator+=(Pigment *other);
 	Pigment operator*(float scalar);
+	Pigment operator*(Pigment other);
 	void operator*=(float scalar);
 	void Print();
 	void PrintBig();
@@ -64,14 +71,41 @@ public:
 	float ambient, diffuse, specular, roughness, reflect, refract, ior;
 };
 
+/* One Pigment and Finish shared by every object that uses it, with the constant */
+/* products BlinnPhong needs worked out once */
+class Material {
+public:
+	Material();
+	Material(Pigment *pigment, Finish *finish);
+	Pigment pigment;
+	Finish finish;
+	Pigment ambient, diffuse, specular; /* finish coefficient * pigment */
+	float shiny; /* 1 / roughness */
+};
+
+/* Interns Materials so objects with identical Pigment and Finish share one entry */
+class MaterialTable {
+public:
+	int Intern(Pigment *pigment, Finish *finish);
+	Material *Get(int index);
+	vector<Material> materials;
+	unordered_map<string, int> index; /* raw Pigment + Finish bytes -> position in materials */
+};
+
 /* Contains Light location "center" and Pigment value */
+/* fade_distance and fade_power attenuate it like POV-Ray; without them it reaches everywhere */
 class Light {
 public:
 	Light();
 	Light(Point center, Pigment pigment);
 	void Print();
+	float Attenuation(float distance);
+	void SetRadius(float cutoff);
 	Point center;
 	Pigment pigment;
+	float fadeDistance, fadePower;
+	float radius; /* distance past which the light adds less than the cutoff, INFINITY if it never fades */
+	int rank; /* place in the order LightTree::Query returns lights, set by LightTree::Build */
 };
 
 /* Contains Camera location "center", up Vector, right Vector, and lookat Point */
@@ -84,74 +118,126 @@ public:
 	Vector up, right;
 };
 
+/* Deepest reflection chain Reflect keeps on its stack */
+const int MAX_DEPTH = 64;
+
+/* When Reflect stops following mirrors, shared by every Geometry in a Scene */
+class BounceLimits {
+public:
+	BounceLimits();
+	int maxDepth; /* reflection rays per primary hit, at most MAX_DEPTH; callers may pass Reflect less */
+	float minThroughput; /* don't trace a bounce whose weight in the pixel is below this */
+};
+
+/* Where a ray met a Geometry and what Blinn Phong made of it there. Each shading call */
+/* fills its own, so Geometry stays read only and one Scene can be shaded by every thread */
+class HitRecord {
+public:
+	HitRecord();
+	Point onGeom; /* Point on geometry itself */
+	Vector normal;
+	Pigment pigmentA, pigmentD, pigmentS; /* Ambient, Diffuse, and Specular pigments during Blinn Phong */
+	Pigment truePigment; /* full object color after BlinnPhong */
+};
+
 /* Parent class to all Geometric objects */
 class Geometry {
 public:
 	Geometry();
+	virtual ~Geometry() {} /* Scene deletes shapes through Geometry pointers */
 	virtual void Print();
 	virtual void PrintType();
+	virtual const char *TypeName();
 	virtual float Intersect(int i, int j, Ray *ray);
-	virtual Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist);
-	virtual void SetNormal();
-	void BlinnPhongAmbient();
-	void BlinnPhongDiffuse();
-	void BlinnPhongSpecular();
-	void SetOnGeom(Ray *ray, float rayDistance);
-	bool ShadowFeeler(int i, int j);
-	void ResetPigments();
-	Pigment Reflect(int i, int j, float rayDist, Ray ray, int bounce); /* watch out for pointers pointing to garbage later */
-	Pigment pigment; /* stores object color */
-	Pigment truePigment; /* stores full object color after BlinnPhong */
-	Finish finish; /* stores finish informatino */
-	Vector normal;
-	Point onGeom; /* stores Point on geometry itself */
-	
-	Pigment pigmentA, pigmentD, pigmentS; /* stores Ambient, Diffuse, and Specular pigments during Blinn Phong */
-	Ray feeler; /* stores shadow feeler for Blinn Phong */
-	
+	virtual Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record);
+	virtual void SetNormal(HitRecord *record);
+	virtual void SetSurface(Ray *ray, float rayDist, HitRecord *record);
+	virtual bool Specular();
+	virtual void AppendShape(vector<float> *shape);
+	virtual Vector NormalAt(Point *point);
+	void BlinnPhongAmbient(HitRecord *record);
+	void BlinnPhongDiffuse(Light *light, Vector *lightVector, float scale, HitRecord *record);
+	void BlinnPhongSpecular(Light *light, Vector *lightVector, float scale, HitRecord *record);
+	void BlinnPhongLights(int i, int j, bool specular, HitRecord *record);
+	void BlinnPhongSampledLights(int i, int j, bool specular, vector<Light *> *nearby, HitRecord *record);
+	void SetOnGeom(Ray *ray, float rayDistance, HitRecord *record);
+	bool ShadowFeeler(int i, int j, Light *light, HitRecord *record);
+	Pigment Reflect(int i, int j, float rayDist, Ray *ray, class RayNode *node, int maxDepth);
+	void Shade(int i, int j, Ray *ray, float rayDist, HitRecord *record);
+	Material *GetMaterial();
 	Camera *camera;
-	Light *light;
+	class LightTree *lights;
+	MaterialTable *materials;
+	int material; /* index into materials, set when parsed */
+	BounceLimits *bounceLimits;
 	vector<Geometry *> *allGeometry;
+	int line; /* line in the .pov file this object started on */
+	int index; /* position in allGeometry, set by Scene::Setup */
 };
 
+/* True when nothing lies between from and light */
+bool lightVisible(vector<Geometry *> *allGeometry, int i, int j, Point *from, class Light *light);
+
+/* Bend incident through surface (normal pointing out of an object of index ior), or reflect it */
+/* back on total internal reflection; returns the Schlick reflectance, 1 when nothing gets through */
+float refractRay(Ray *incident, Point *surface, Vector *normal, float ior, Ray *refracted);
+
+/* Return the closest Geometry along ray nearer than *distance (updating it), or NULL on a miss */
+Geometry *closestHit(vector<Geometry *> *allGeometry, int i, int j, Ray *ray, float *distance);
+
 /* Child of Geometry, contains center Point and radius value */
 class Sphere : public Geometry {
 public:
 	Sphere();
-	Sphere(Point *center, float radius, Pigment *pigment, Finish *finish);
+	Sphere(Point *center, float radius, int material);
 	void Print();
 	void PrintType();
+	const char *TypeName();
 	float Intersect(int i, int j, Ray *ray);
-	Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist);
-	void SetNormal();
+	Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record);
+	void SetSurface(Ray *ray, float rayDist, HitRecord *record);
+	void AppendShape(vector<float> *shape);
+	Vector NormalAt(Point *point);
+	bool Specular();
+	void SetNormal(HitRecord *record);
 	Point center;
 	float radius;
 };
 
-/* Child of Geometry, inherits normal Vector and contains distance along normal Vecor */
+/* Child of Geometry, contains normal Vector and distance along normal Vecor */
 class Plane : public Geometry {
 public:
 	Plane();
-	Plane(Vector *normal, float distance, Pigment *pigment, Finish *finish);
+	Plane(Vector *normal, float distance, int material);
 	void Print();
 	void PrintType();
+	const char *TypeName();
 	float Intersect(int i, int j, Ray *ray);
-	Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist);
-	void SetOnGeom();
+	Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record);
+	void SetSurface(Ray *ray, float rayDist, HitRecord *record);
+	void AppendShape(vector<float> *shape);
+	Vector NormalAt(Point *point);
+	void SetPoint();
+	Vector normal;
 	float distance; /* Distance along normal defines plane location */
+	Point point; /* fixed point on the plane */
 };
 
-/* Child of Geometry, inherits normal vector, contains three defining vertices */
+/* Child of Geometry, contains three defining vertices */
 class Triangle : public Geometry {
 public:
 	Triangle();
 	Triangle(Point *vertexA, Point *vertexB, Point *vertexC);
 	void SetVectors();
-	void SetNormal(Ray *ray);
+	void SetNormal(Ray *ray, HitRecord *record);
 	void Print();
 	void PrintType();
+	const char *TypeName();
 	float Intersect(int i, int j, Ray *ray);
-	Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist);
+	Pigment BlinnPhong(int i, int j, Ray *ray, float rayDist, HitRecord *record);
+	void SetSurface(Ray *ray, float rayDist, HitRecord *record);
+	void AppendShape(vector<float> *shape);
+	Vector NormalAt(Point *point);
 	Point vertexA, vertexB, vertexC;
 	Vector AB, AC; /* helpful when setting normal Vector */
 };
@@ -0,0 +1,498 @@
+#include "options.h"
+#include "objs.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+PixelCoord::PixelCoord() {
+	i = j = 0;
+}
+
+PixelCoord::PixelCoord(int i, int j) {
+	this->i = i;
+	this->j = j;
+}
+
+Options::Options() {
+	width = height = 0;
+	fileName = "";
+	output = "simple_reflect3.tga";
+	golden = baseline = "";
+	record = false;
+	perf = false;
+	profileTop = 0;
+	lightCutoff = 1 / 256.0;
+	lightSamples = 0;
+	samples = 1;
+	deferred = false;
+	gbuffer = "";
+	aa = 0;
+	aaThreshold = 0.1;
+	maxDepth = 5;
+	minThroughput = 1 / 256.0;
+	path = false;
+	pathSamples = 256;
+	timeBudget = 0;
+	noise = 0.02;
+	threads = 0;
+	tileSize = 16;
+	sceneImage = "";
+	checkpoint = "";
+	checkpointInterval = 60;
+	resume = false;
+	listen = "";
+	worker = "";
+	batch = "";
+	serve = "";
+	sceneCache = 8;
+	server = "";
+	sendScene = false;
+	region = false;
+	regionX0 = regionY0 = regionX1 = regionY1 = 0;
+	composite = "";
+	progressive = false;
+	previewInterval = 1;
+	sampler = SAMPLER_SOBOL;
+	denoise = 0;
+	maxError = 1;
+	minPsnr = 40;
+	maxSlowdown = 1.25;
+	timeSlack = 20;
+}
+
+void Options::PrintUsage() {
+	cout << "Error. Usage: ./raytrace <width> <height> <input_filename> [options]" << endl;
+	cout << "       ./raytrace --worker address [--threads n]" << endl;
+	cout << "       ./raytrace --batch manifest [options]" << endl;
+	cout << "       ./raytrace --serve address [--scene-cache n] [options]" << endl;
+	cout << "  --output file.tga   where to write the render (default simple_reflect3.tga)" << endl;
+	cout << "  --debug-pixel x,y   dump the ray tree for pixel (x, y), may be repeated" << endl;
+	cout << "  --region x0,y0,x1,y1  trace only pixels x0 <= x < x1, y0 <= y < y1 and write just that window" << endl;
+	cout << "  --composite file    paste the --region render into this earlier full frame render" << endl;
+	cout << "  --light-cutoff c    skip fading lights once they add less than c (default 1/256)" << endl;
+	cout << "  --light-samples k   shade with k lights drawn by estimated contribution" << endl;
+	cout << "  --spp n             average n samples per pixel (default 1)" << endl;
+	cout << "  --deferred          shade primary hits in batches grouped by material" << endl;
+	cout << "  --progressive       write coarse previews to the output file while rendering" << endl;
+	cout << "  --preview-interval s rewrite the preview at least every s seconds (default 1)" << endl;
+	cout << "  --aa n              supersample pixels on edges with n x n rays (default 0, off)" << endl;
+	cout << "  --aa-threshold t    neighbour color difference that marks an edge (default 0.1)" << endl;
+	cout << "  --scene-image file  load the scene from a pre-parsed image in file instead of parsing, writing it first if stale" << endl;
+	cout << "  --gbuffer file      reuse primary hits from file when only lights or finishes changed" << endl;
+	cout << "  --max-depth n       follow at most n reflections per pixel (default 5)" << endl;
+	cout << "  --min-throughput t  stop reflecting once a bounce adds less than t (default 1/256)" << endl;
+	cout << "  --path              path trace with diffuse and glossy bounces, refined in passes" << endl;
+	cout << "  --path-spp n        most paths per pixel in --path mode (default 256)" << endl;
+	cout << "  --noise e           stop refining a pixel at relative error e (default 0.02, 0 for off)" << endl;
+	cout << "  --time-budget s     finish in s seconds: --path stops refining, Whitted lowers quality (default 0, no limit)" << endl;
+	cout << "  --denoise n         smooth noise with n edge-aware filter passes, 5 is typical, at most log2 of the image size (default 0)" << endl;
+	cout << "  --sampler name      random, sobol (Owen scrambled, default) or blue (blue noise across pixels)" << endl;
+	cout << "  --threads n         render threads (default 0, one per core)" << endl;
+	cout << "  --checkpoint file   snapshot finished tiles or path samples to file while rendering" << endl;
+	cout << "  --checkpoint-interval s  seconds between snapshots (default 60)" << endl;
+	cout << "  --resume            carry on from the --checkpoint file, skipping finished work" << endl;
+	cout << "  --listen address    coordinate --worker processes on host:port or a socket path" << endl;
+	cout << "  --worker address    render tiles for the coordinator at address, no scene arguments needed" << endl;
+	cout << "  --batch manifest    render each \"width height scene.pov output.tga [options]\" line of manifest" << endl;
+	cout << "  --serve address     render requests from --server clients on a socket path, keeping parsed scenes" << endl;
+	cout << "  --scene-cache n     parsed scenes --serve keeps, least recently used dropped first (default 8)" << endl;
+	cout << "  --server address    render in the --serve daemon at address, which writes --output" << endl;
+	cout << "  --send-scene        send --server the scene text instead of its path" << endl;
+	cout << "  --tile-size n       side of the square tiles threads render at a time (default 16)" << endl;
+	cout << "  --perf              report cycles, instructions and misses per phase" << endl;
+	cout << "  --profile n         report the n objects that cost the most time" << endl;
+	cout << "  --golden file.tga   compare the render against a golden image" << endl;
+	cout << "  --baseline file     compare render time against a stored baseline" << endl;
+	cout << "  --record            store the render and time as the new golden/baseline" << endl;
+	cout << "  --max-error n       largest allowed channel error, 0-255 (default 1)" << endl;
+	cout << "  --min-psnr db       smallest allowed PSNR (default 40)" << endl;
+	cout << "  --max-slowdown r    largest allowed time / baseline ratio (default 1.25)" << endl;
+	cout << "  --time-slack ms     slowdowns under ms always pass, short renders are mostly timer noise (default 20)" << endl;
+}
+
+/* Return the argument after flag a, or NULL (with an error) if there isn't one */
+static char *flagValue(int argc, char *argv[], int *a) {
+	if (*a + 1 >= argc) {
+		cout << "Error. " << argv[*a] << " expects a value" << endl;
+		return NULL;
+	}
+
+	return argv[++*a];
+}
+
+/* Read a string flag value into result, return 1 if it's missing */
+static int stringFlag(int argc, char *argv[], int *a, string *result) {
+	char *value = flagValue(argc, argv, a);
+
+	if (!value)
+		return 1;
+
+	*result = value;
+	return 0;
+}
+
+/* Read a float flag value into result, return 1 on bad input */
+static int floatFlag(int argc, char *argv[], int *a, float *result) {
+	char *value = flagValue(argc, argv, a), *end;
+
+	if (!value)
+		return 1;
+
+	*result = strtof(value, &end);
+	if (end == value || *end) {
+		cout << "Error. " << argv[*a - 1] << " expects a number" << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Read a non-negative integer flag value into result, return 1 on bad input */
+static int intFlag(int argc, char *argv[], int *a, int *result) {
+	char *value = flagValue(argc, argv, a), *end;
+
+	if (!value)
+		return 1;
+
+	*result = strtol(value, &end, 10);
+	if (end == value || *end || *result < 0) {
+		cout << "Error. " << argv[*a - 1] << " expects a whole number" << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+bool wholeNumber(string *word) {
+	char *end;
+	long value = strtol(word->c_str(), &end, 10);
+
+	return value > 0 && value <= INT_MAX && !*end;
+}
+
+/* Walk argv, pulling out flags and leaving width, height and file name in order */
+int parseOptions(int argc, char *argv[], Options *options) {
+	vector<char *> positional;
+
+	options->arguments.assign(argv + 1, argv + argc);
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp(argv[a], "--debug-pixel")) {
+			PixelCoord pixel;
+
+			if (a + 1 >= argc || sscanf(argv[++a], "%d,%d", &pixel.i, &pixel.j) != 2) {
+				cout << "Error. --debug-pixel expects x,y" << endl;
+				return 1;
+			}
+			options->debugPixels.push_back(pixel);
+		}
+		else if (!strcmp(argv[a], "--region")) {
+			if (a + 1 >= argc || sscanf(argv[++a], "%d,%d,%d,%d", &options->regionX0, &options->regionY0, &options->regionX1,
+				&options->regionY1) != 4) {
+				cout << "Error. --region expects x0,y0,x1,y1" << endl;
+				return 1;
+			}
+			options->region = true;
+		}
+		else if (!strcmp(argv[a], "--composite")) {
+			if (stringFlag(argc, argv, &a, &options->composite))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--output")) {
+			if (stringFlag(argc, argv, &a, &options->output))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--golden")) {
+			if (stringFlag(argc, argv, &a, &options->golden))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--baseline")) {
+			if (stringFlag(argc, argv, &a, &options->baseline))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--light-cutoff")) {
+			if (floatFlag(argc, argv, &a, &options->lightCutoff))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--light-samples")) {
+			if (intFlag(argc, argv, &a, &options->lightSamples))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--deferred"))
+			options->deferred = true;
+		else if (!strcmp(argv[a], "--progressive"))
+			options->progressive = true;
+		else if (!strcmp(argv[a], "--preview-interval")) {
+			if (floatFlag(argc, argv, &a, &options->previewInterval))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--aa")) {
+			if (intFlag(argc, argv, &a, &options->aa))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--aa-threshold")) {
+			if (floatFlag(argc, argv, &a, &options->aaThreshold))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--gbuffer")) {
+			if (stringFlag(argc, argv, &a, &options->gbuffer))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--max-depth")) {
+			if (intFlag(argc, argv, &a, &options->maxDepth))
+				return 1;
+
+			if (options->maxDepth > MAX_DEPTH) {
+				cout << "Error. --max-depth is at most " << MAX_DEPTH << endl;
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[a], "--min-throughput")) {
+			if (floatFlag(argc, argv, &a, &options->minThroughput))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--path"))
+			options->path = true;
+		else if (!strcmp(argv[a], "--path-spp")) {
+			if (intFlag(argc, argv, &a, &options->pathSamples))
+				return 1;
+
+			if (options->pathSamples < 1) {
+				cout << "Error. --path-spp needs at least 1 sample" << endl;
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[a], "--noise")) {
+			if (floatFlag(argc, argv, &a, &options->noise))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--time-budget")) {
+			if (floatFlag(argc, argv, &a, &options->timeBudget))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--denoise")) {
+			if (intFlag(argc, argv, &a, &options->denoise))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--sampler")) {
+			char *value = flagValue(argc, argv, &a);
+
+			if (!value)
+				return 1;
+
+			if (!parseSampler(value, &options->sampler)) {
+				cout << "Error. --sampler expects random, sobol or blue" << endl;
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[a], "--tile-size")) {
+			if (intFlag(argc, argv, &a, &options->tileSize))
+				return 1;
+
+			if (options->tileSize < 1) {
+				cout << "Error. --tile-size needs at least 1 pixel" << endl;
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[a], "--scene-image")) {
+			if (stringFlag(argc, argv, &a, &options->sceneImage))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--checkpoint")) {
+			if (stringFlag(argc, argv, &a, &options->checkpoint))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--checkpoint-interval")) {
+			if (floatFlag(argc, argv, &a, &options->checkpointInterval))
+				return 1;
+
+			if (options->checkpointInterval <= 0) {
+				cout << "Error. --checkpoint-interval must be positive" << endl;
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[a], "--resume"))
+			options->resume = true;
+		else if (!strcmp(argv[a], "--listen")) {
+			if (stringFlag(argc, argv, &a, &options->listen))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--worker")) {
+			if (stringFlag(argc, argv, &a, &options->worker))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--batch")) {
+			if (stringFlag(argc, argv, &a, &options->batch))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--serve")) {
+			if (stringFlag(argc, argv, &a, &options->serve))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--scene-cache")) {
+			if (intFlag(argc, argv, &a, &options->sceneCache))
+				return 1;
+
+			if (options->sceneCache < 1) {
+				cout << "Error. --scene-cache needs room for at least 1 scene" << endl;
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[a], "--server")) {
+			if (stringFlag(argc, argv, &a, &options->server))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--send-scene"))
+			options->sendScene = true;
+		else if (!strcmp(argv[a], "--threads")) {
+			if (intFlag(argc, argv, &a, &options->threads))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--spp")) {
+			if (intFlag(argc, argv, &a, &options->samples))
+				return 1;
+
+			if (options->samples < 1) {
+				cout << "Error. --spp needs at least 1 sample" << endl;
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[a], "--perf"))
+			options->perf = true;
+		else if (!strcmp(argv[a], "--profile")) {
+			if (intFlag(argc, argv, &a, &options->profileTop))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--record"))
+			options->record = true;
+		else if (!strcmp(argv[a], "--max-error")) {
+			if (floatFlag(argc, argv, &a, &options->maxError))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--min-psnr")) {
+			if (floatFlag(argc, argv, &a, &options->minPsnr))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--max-slowdown")) {
+			if (floatFlag(argc, argv, &a, &options->maxSlowdown))
+				return 1;
+		}
+		else if (!strcmp(argv[a], "--time-slack")) {
+			if (floatFlag(argc, argv, &a, &options->timeSlack))
+				return 1;
+		}
+		else if (!strncmp(argv[a], "--", 2)) {
+			cout << "Error. Unknown option " << argv[a] << endl;
+			options->PrintUsage();
+			return 1;
+		}
+		else
+			positional.push_back(argv[a]);
+	}
+
+	/* A worker gets the scene and everything else from its coordinator */
+	if (options->worker.size())
+		return 0;
+
+	/* Batch jobs and requests to --serve name their own scenes; the flags here are defaults for every one */
+	if (options->batch.size() || options->serve.size()) {
+		if (positional.size()) {
+			cout << "Error. " << (options->batch.size() ? "--batch takes scenes from the manifest" : "--serve takes scenes from requests")
+				<< ", not the command line." << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (positional.size() < 3) {
+		options->PrintUsage();
+		return 1;
+	}
+
+	string width = positional[0], height = positional[1];
+
+	if (!wholeNumber(&width) || !wholeNumber(&height)) {
+		cout << "Error. Width and height must be whole numbers of at least 1." << endl;
+		return 1;
+	}
+
+	options->width = strtol(width.c_str(), NULL, 10);
+	options->height = strtol(height.c_str(), NULL, 10);
+	options->fileName = positional[2];
+
+	if (!options->region) {
+		options->regionX1 = options->width;
+		options->regionY1 = options->height;
+	}
+	else if (options->regionX0 < 0 || options->regionY0 < 0 || options->regionX1 > options->width ||
+		options->regionY1 > options->height || options->regionX0 >= options->regionX1 || options->regionY0 >= options->regionY1) {
+		cout << "Error. --region must be a non-empty window inside the " << options->width << "x" << options->height << " image." << endl;
+		return 1;
+	}
+	else if (options->deferred || options->aa || options->gbuffer.size() || options->denoise) {
+		cout << "Error. --region works with the default, --progressive and --path renders only." << endl;
+		return 1;
+	}
+	else if (options->golden.size() && !options->composite.size()) {
+		cout << "Error. --golden needs a full frame; add --composite to check a --region render." << endl;
+		return 1;
+	}
+
+	/* Pass p samples neighbours 1 << p pixels apart; once that spans the image, more passes */
+	/* only blur, and past 30 the step overflows */
+	int maxPasses = 1;
+	while (maxPasses < 30 && (1 << maxPasses) < max(options->width, options->height))
+		maxPasses++;
+
+	if (options->denoise > maxPasses) {
+		cout << "Error. --denoise takes at most " << maxPasses << " passes at " << options->width << "x" << options->height << "." << endl;
+		return 1;
+	}
+
+	if (options->listen.size() && (options->path || options->deferred || options->progressive)) {
+		cout << "Error. --listen distributes the default Whitted render only." << endl;
+		return 1;
+	}
+
+	/* Workers render every tile at full quality, they never see a clock */
+	if (options->listen.size() && options->timeBudget) {
+		cout << "Error. --time-budget doesn't work with --listen." << endl;
+		return 1;
+	}
+
+	if (options->checkpoint.size() && (options->deferred || options->progressive || options->listen.size())) {
+		cout << "Error. --checkpoint works with the default and --path renders only." << endl;
+		return 1;
+	}
+
+	if (options->sendScene && !options->server.size()) {
+		cout << "Error. --send-scene needs --server." << endl;
+		return 1;
+	}
+
+	if (options->resume && !options->checkpoint.size()) {
+		cout << "Error. --resume needs --checkpoint." << endl;
+		return 1;
+	}
+
+	if (options->composite.size() && !options->region) {
+		cout << "Error. --composite needs --region." << endl;
+		return 1;
+	}
+
+	for (int p = 0; p < options->debugPixels.size(); p++) {
+		PixelCoord *pixel = &options->debugPixels[p];
+
+		if (pixel->i < 0 || pixel->i >= options->width || pixel->j < 0 || pixel->j >= options->height) {
+			cout << "Error. Debug pixel [" << pixel->i << ", " << pixel->j << "] is outside the image." << endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
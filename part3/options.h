@@ -0,0 +1,72 @@
+#pragma once
+#include "sampler.h"
+#include <vector>
+#include <string>
+using namespace std;
+
+/* Pixel coordinates chosen for ray tree debugging */
+class PixelCoord {
+public:
+	PixelCoord();
+	PixelCoord(int i, int j);
+	int i, j;
+};
+
+/* Command line settings, positional arguments and optional flags */
+class Options {
+public:
+	Options();
+	void PrintUsage();
+	int width, height;
+	string fileName;
+	string output; /* --output, defaults to simple_reflect3.tga */
+	vector<PixelCoord> debugPixels; /* --debug-pixel x,y (repeatable) */
+	bool perf; /* --perf, hardware counters per phase */
+	int profileTop; /* --profile n, report the n most expensive objects */
+	float lightCutoff; /* --light-cutoff, contribution below which a fading light is ignored */
+	int lightSamples; /* --light-samples k, sample k lights per hit instead of visiting them all */
+	int samples; /* --spp n, traces averaged per pixel */
+	bool deferred; /* --deferred, shade primary hits in material batches */
+	string sceneImage; /* --scene-image file, scene loaded from a pre-parsed image in file, written there first if missing or stale */
+	string gbuffer; /* --gbuffer file, primary hits cached between renders */
+	int aa; /* --aa n, supersample edge pixels with n x n rays, 0 for none */
+	float aaThreshold; /* --aa-threshold t, color difference (0 -> 1) that counts as an edge */
+	int maxDepth; /* --max-depth n, reflection rays followed from one primary hit */
+	float minThroughput; /* --min-throughput t, stop bouncing once a ray can add less than t */
+	bool path; /* --path, progressive path tracing instead of Whitted reflections */
+	int pathSamples; /* --path-spp n, most paths traced through one pixel */
+	float timeBudget; /* --time-budget s, stop path refinement or degrade Whitted tiles to finish in s seconds, 0 for no limit */
+	float noise; /* --noise e, relative standard error at which a pixel stops, 0 to always use every sample */
+	int threads; /* --threads n, 0 for one per core */
+	bool progressive; /* --progressive, write 1/8, 1/4 and 1/2 resolution previews on the way */
+	float previewInterval; /* --preview-interval s, also write a preview every s seconds, 0 for only between levels */
+	bool region; /* --region x0,y0,x1,y1, render only [x0, x1) x [y0, y1); the whole frame otherwise */
+	int regionX0, regionY0, regionX1, regionY1;
+	string composite; /* --composite file.tga, paste the region into this full frame render instead of cropping */
+	string listen; /* --listen address, hand tiles to --worker processes connecting on host:port or a Unix socket path */
+	string worker; /* --worker address, render tiles for the coordinator at address instead of a scene of our own */
+	vector<string> arguments; /* argv past the program name, which --listen sends its workers */
+	string batch; /* --batch manifest, render every job listed in manifest instead of one scene */
+	string serve; /* --serve address, stay up rendering requests from --server clients on address */
+	int sceneCache; /* --scene-cache n, parsed scenes --serve keeps for reuse */
+	string server; /* --server address, have the --serve daemon at address render this instead */
+	bool sendScene; /* --send-scene, send --server the .pov text rather than its path */
+	string checkpoint; /* --checkpoint file, snapshot the render in progress to file */
+	float checkpointInterval; /* --checkpoint-interval s, seconds between snapshots */
+	bool resume; /* --resume, carry on from --checkpoint rather than starting over */
+	int tileSize; /* --tile-size n, side of the square tiles threads take work in */
+	int denoise; /* --denoise n, edge-aware filter passes over the render, 0 for none */
+	SamplerType sampler; /* --sampler random|sobol|blue, numbers for --path and --aa */
+
+	/* Regression checking, see regress.h */
+	string golden, baseline;
+	bool record;
+	float maxError, minPsnr, maxSlowdown;
+	float timeSlack; /* --time-slack ms, slowdowns smaller than this pass whatever the ratio */
+};
+
+/* True if word is a whole number of at least 1 that fits an int, as widths and heights must be */
+bool wholeNumber(string *word);
+
+/* Fill in options from argv, return 1 and print usage on bad input */
+int parseOptions(int argc, char *argv[], Options *options);
@@ -1,30 +1,63 @@
 #include "parse.h"
 #include "objs.h"
+#include "options.h"
+#include "scene.h"
+#include "sceneimage.h"
 #include <stdio.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <stdio.h>
 #include <string.h>
 #include <string>
+#include <limits>
 #include <vector>
 using namespace std;
 
-/* Check argc and usage, fill in variables, attempt to open povray file */
-int fileOps(int argc, char *argv[], int *width, int *height, vector<Geometry *> *allGeometry, Camera *camera, Light *light) {
-	string fileName;
-	fstream povray;
+/* --scene-image: build the scene from the flat image when it matches the .pov text, */
+/* otherwise parse the text and leave an image for the next process */
+static int sceneImageOps(Options *options, Scene *scene) {
+	ifstream povray(options->fileName.c_str(), ios::binary);
+	stringstream buffer;
+	string text;
 
-	if (argc < 4) {
-		cout << "Error. Usage: ./raytrace <width> <height> <input_filename>" << endl;
+	if (!povray.is_open()) {
+		cout << "Error opening file." << endl;
 		return 1;
 	}
 
-	fileName = argv[3];
-	povray.open(fileName, fstream::in);
+	buffer << povray.rdbuf();
+	text = buffer.str();
+
+	if (!loadSceneImage(options->sceneImage.c_str(), &text, scene)) {
+		istringstream lines(text);
+
+		if (parse(&lines, scene))
+			return 1;
+		if (saveSceneImage(options->sceneImage.c_str(), &text, scene))
+			cout << "Scene image " << options->sceneImage << " written." << endl;
+		else
+			cout << "Error writing scene image " << options->sceneImage << ", continuing without it." << endl;
+	}
+
+	scene->Setup(options);
+
+	return 0;
+}
+
+/* Attempt to open povray file named in options, fill in the scene */
+int fileOps(Options *options, Scene *scene) {
+	fstream povray;
+
+	if (options->sceneImage.size())
+		return sceneImageOps(options, scene);
+
+	povray.open(options->fileName, fstream::in);
 
 	/* Attempt to open and parse povray file */
 	if (povray.is_open()) {
-		parse(&povray, allGeometry, camera, light);
+		if (parse(&povray, scene))
+			return 1;
 		povray.close();
 	}
 	else {
@@ -32,285 +65,315 @@ int fileOps(int argc, char *argv[], int *width, int *height, vector<Geometry *>
 		return 1;
 	}
 
-	*width = stoi(argv[1], NULL);
-	*height = stoi(argv[2], NULL);
+	scene->Setup(options);
 
-	for (int g = 0; g < allGeometry->size(); g++) {
-		allGeometry->at(g)->light = light;
-		allGeometry->at(g)->camera = camera;
-		allGeometry->at(g)->allGeometry = allGeometry;
-	}
+	return 0;
+}
+
+/* Same as fileOps, with the file's contents already in memory */
+int sceneFromText(Options *options, Scene *scene, string *text) {
+	istringstream povray(*text);
+
+	if (parse(&povray, scene))
+		return 1;
+	scene->Setup(options);
 
 	return 0;
 }
 
-/* Parse through povray file, create setting and geometry */
-void parse(fstream *povray, vector<Geometry *> *allGeometry, Camera *camera, Light *light) {
+/* getline that keeps count, so geometry can remember where it came from. A line too long */
+/* for the buffer is reported and cut short, rather than ending the scene there */
+static bool readLine(istream *povray, char *line, int *lineNumber) {
+	if (!povray->getline(line, 99)) {
+		if (povray->eof() || povray->gcount() != 98)
+			return false;
+
+		povray->clear();
+		povray->ignore(numeric_limits<streamsize>::max(), '\n');
+		cout << "Error. Line " << *lineNumber + 1 << " is longer than 98 characters, only its start was read." << endl;
+	}
+
+	(*lineNumber)++;
+	return true;
+}
+
+/* The next line of an object. Past the end of the file it's empty, so the tokens it should */
+/* have had are reported against the line that's missing */
+static void objectLine(istream *povray, char *line, int *lineNumber) {
+	if (!readLine(povray, line, lineNumber)) {
+		line[0] = '\0';
+		(*lineNumber)++;
+	}
+}
+
+/* The next token strtok_r finds from start (NULL to carry on through rest) as a float; */
+/* false if the line has run out */
+static bool floatToken(char *start, const char *delimiters, char **rest, float *value) {
+	char *token = strtok_r(start, delimiters, rest);
+
+	if (!token)
+		return false;
+
+	*value = strtof(token, NULL);
+	return true;
+}
+
+/* Print what a line was missing; returns 1 for parse() to give up with */
+static int parseError(int lineNumber, const char *expected) {
+	cout << "Error. Line " << lineNumber << ": expected " << expected << "." << endl;
+	return 1;
+}
+
+/* fade_distance and fade_power, from token on through what's left of the line in rest */
+static void fillFade(Light *light, char *token, char **rest) {
+	for (; token; token = strtok_r(NULL, " \t<>,}", rest)) {
+		if (!strcmp(token, "fade_distance") && (token = strtok_r(NULL, " \t}", rest)))
+			light->fadeDistance = strtof(token, NULL);
+		else if (!strcmp(token, "fade_power") && (token = strtok_r(NULL, " \t}", rest)))
+			light->fadePower = strtof(token, NULL);
+	}
+}
+
+/* Parse through povray file, create setting and geometry. Lines are cut up with strtok_r, */
+/* so scenes can be parsed on several threads at once */
+int parse(istream *povray, Scene *scene) {
+	Camera *camera = &scene->camera;
+	Light *light;
 	Sphere *sphere;
 	Plane *plane;
 	Triangle *triangle;
-	int rgbf, vals;
-	char line[100], finishLine[100], *token;
-	string finishVals[6];
+	Pigment pigment;
+	Finish finish;
+	int rgbf, lineNumber = 0, startLine;
+	bool closed;
+	char line[100], *token, *rest;
 
 
 	/* While povray file still contains unread lines */
-	while (povray->getline(line, 99)) {
+	while (readLine(povray, line, &lineNumber)) {
 
 		/* Ignore comments in povray file */
 		if (line[0] != '/') {
 			/* Fill "token" with key words from file */
 			/* Watch out for empty lines */
-			token = strtok(line, " \t\n}");
+			token = strtok_r(line, " \t\n}", &rest);
+			startLine = lineNumber;
 
 			if (token) {
 				if (!strcmp(token, "camera")) {
-					povray->getline(line, 99);
 					*camera = Camera();
 
 					/* Fill in Camera center point */
-					token = strtok(line, " \tlocation<,");
-					camera->center.x = strtof(token, NULL);
-					token = strtok(NULL, ", ");
-					camera->center.y = strtof(token, NULL);
-					token = strtok(NULL, ", >");
-					camera->center.z = strtof(token, NULL);
+					objectLine(povray, line, &lineNumber);
+					if (!floatToken(line, " \tlocation<,", &rest, &camera->center.x) ||
+						!floatToken(NULL, ", ", &rest, &camera->center.y) || !floatToken(NULL, ", >", &rest, &camera->center.z))
+						return parseError(lineNumber, "location <x, y, z>");
 
 					/* Fill in Camera up vector */
-					povray->getline(line, 99);
-					token = strtok(line, " \tup<,");
-					camera->up.x = strtof(token, NULL);
-					token = strtok(NULL, ", ");
-					camera->up.y = strtof(token, NULL);
-					token = strtok(NULL, ", >");
-					camera->up.z = strtof(token, NULL);
+					objectLine(povray, line, &lineNumber);
+					if (!floatToken(line, " \tup<,", &rest, &camera->up.x) ||
+						!floatToken(NULL, ", ", &rest, &camera->up.y) || !floatToken(NULL, ", >", &rest, &camera->up.z))
+						return parseError(lineNumber, "up <x, y, z>");
 
 					/* Fill in Camera right vector */
-					povray->getline(line, 99);
-					token = strtok(line, " \tright<,");
-					camera->right.x = strtof(token, NULL);
-					token = strtok(NULL, ", ");
-					camera->right.y = strtof(token, NULL);
-					token = strtok(NULL, ", >");
-					camera->right.z = strtof(token, NULL);
+					objectLine(povray, line, &lineNumber);
+					if (!floatToken(line, " \tright<,", &rest, &camera->right.x) ||
+						!floatToken(NULL, ", ", &rest, &camera->right.y) || !floatToken(NULL, ", >", &rest, &camera->right.z))
+						return parseError(lineNumber, "right <x, y, z>");
 
 					/* Fill in Camera lookat point */
-					povray->getline(line, 99);
-					token = strtok(line, " \tlook_at<,");
-					camera->lookat.x = strtof(token, NULL);
-					token = strtok(NULL, ", ");
-					camera->lookat.y = strtof(token, NULL);
-					token = strtok(NULL, ", >");
-					camera->lookat.z = strtof(token, NULL);
+					objectLine(povray, line, &lineNumber);
+					if (!floatToken(line, " \tlook_at<,", &rest, &camera->lookat.x) ||
+						!floatToken(NULL, ", ", &rest, &camera->lookat.y) || !floatToken(NULL, ", >", &rest, &camera->lookat.z))
+						return parseError(lineNumber, "look_at <x, y, z>");
 
 					/* Initialize magnitude of up and right vectors */
 					camera->up.SetMagnitude(camera->up.x, camera->up.y, camera->up.z);
 					camera->right.SetMagnitude(camera->right.x, camera->right.y, camera->right.z);
 				}
 				else if (!strcmp(token, "light_source")) {
-					*light = Light();
+					/* The scene owns everything added to it, so an object left half read frees with it */
+					light = new Light();
+					scene->lights.push_back(light);
+
+					/* Checked before strtok_r cuts up the rest of the line: a light_source not */
+					/* closed here carries on to the lines up to its } */
+					closed = strchr(rest, '}') != NULL;
 
 					/* Fill in Light center point */
-					token = strtok(NULL, " {<,");
-					light->center.x = strtof(token, NULL);
-					token = strtok(NULL, " {<,");
-					light->center.y = strtof(token, NULL);
-					token = strtok(NULL, " {<,");
-					light->center.z = strtof(token, NULL);
+					if (!floatToken(NULL, " {<,", &rest, &light->center.x) || !floatToken(NULL, " {<,", &rest, &light->center.y) ||
+						!floatToken(NULL, " {<,", &rest, &light->center.z))
+						return parseError(lineNumber, "light_source {<x, y, z>");
 
-					strtok(NULL, " ");
-					token = strtok(NULL, " ");
+					strtok_r(NULL, " ", &rest);
+					token = strtok_r(NULL, " ", &rest);
 
 					/* Determine if Pigment color is rgb or rgbf */
+					if (!token)
+						return parseError(lineNumber, "color rgb or rgbf after the light's center");
 					rgbf = !strcmp(token, "rgbf");
 
-					/* Fill in Light Pigment */
-					token = strtok(NULL, "< ,");
-					light->pigment.r = strtof(token, NULL);
-					token = strtok(NULL, " ,");
-					light->pigment.g = strtof(token, NULL);
-					token = strtok(NULL, " ,");
-					light->pigment.b = strtof(token, NULL);
-					
-					/* Fill in Light Pigment f value */
-					if (rgbf) {
-						token = strtok(NULL, " >}");
-						light->pigment.f = strtof(token, NULL);
-					}
-					else
+					/* Fill in Light Pigment, and its f value */
+					if (!floatToken(NULL, "< ,", &rest, &light->pigment.r) || !floatToken(NULL, " ,", &rest, &light->pigment.g) ||
+						!floatToken(NULL, " ,", &rest, &light->pigment.b) || (rgbf && !floatToken(NULL, " >}", &rest, &light->pigment.f)))
+						return parseError(lineNumber, "the light's color <r, g, b> or <r, g, b, f>");
+					if (!rgbf)
 						light->pigment.f = 0;
+
+					/* Optional fade_distance and fade_power, on the same line or the ones after */
+					fillFade(light, strtok_r(NULL, " \t<>,}", &rest), &rest);
+					while (!closed && readLine(povray, line, &lineNumber)) {
+						closed = strchr(line, '}') != NULL;
+						fillFade(light, strtok_r(line, " \t<>,}", &rest), &rest);
+					}
 				}
 				else if (!strcmp(token, "sphere")) {
 					sphere = new Sphere();
+					sphere->line = startLine;
+					scene->allGeometry.push_back(sphere);
 
-					/* Fill in sphere center point */
-					token = strtok(NULL, " {<,");
-					sphere->center.x = strtof(token, NULL);
-					token = strtok(NULL, " ,");
-					sphere->center.y = strtof(token, NULL);
-					token = strtok(NULL, " >");
-					sphere->center.z = strtof(token, NULL);
-
-					/* Fill in sphere radius */
-					token = strtok(NULL, " ,");
-					sphere->radius = strtof(token, NULL);
+					/* Fill in sphere center point and radius */
+					if (!floatToken(NULL, " {<,", &rest, &sphere->center.x) || !floatToken(NULL, " ,", &rest, &sphere->center.y) ||
+						!floatToken(NULL, " >", &rest, &sphere->center.z) || !floatToken(NULL, " ,", &rest, &sphere->radius))
+						return parseError(lineNumber, "sphere {<x, y, z>, radius");
 
 					/* Fill in sphere Pigment */
-					povray->getline(line, 99);
-					fillPigment(line, sphere);
+					objectLine(povray, line, &lineNumber);
+					pigment = Pigment();
+					if (!fillPigment(line, &pigment))
+						return parseError(lineNumber, "pigment {color rgb <r, g, b>}");
 
 					/* Fill in sphere Finish */
-					povray->getline(line, 99);
-					fillFinish(line, sphere);
-
-					allGeometry->push_back(sphere);
+					objectLine(povray, line, &lineNumber);
+					finish = Finish();
+					if (!fillFinish(line, &finish))
+						return parseError(lineNumber, "a value after each finish keyword");
+					sphere->materials = &scene->materials;
+					sphere->material = scene->materials.Intern(&pigment, &finish);
 				}
 				else if (!strcmp(token, "plane")) {
 					plane = new Plane();
+					plane->line = startLine;
+					scene->allGeometry.push_back(plane);
 
-					/* Fill in plane normal vector */
-					token = strtok(NULL, " {<,");
-					plane->normal.x = strtof(token, NULL);
-					token = strtok(NULL, " ,");
-					plane->normal.y = strtof(token, NULL);
-					token = strtok(NULL, " ,>");
-					plane->normal.z = strtof(token, NULL);
+					/* Fill in plane normal vector and distance along it */
+					if (!floatToken(NULL, " {<,", &rest, &plane->normal.x) || !floatToken(NULL, " ,", &rest, &plane->normal.y) ||
+						!floatToken(NULL, " ,>", &rest, &plane->normal.z) || !floatToken(NULL, " ,", &rest, &plane->distance))
+						return parseError(lineNumber, "plane {<x, y, z>, distance");
 
 					/* Set Magnitude of normal vector */
 					plane->normal.SetMagnitude(plane->normal.x, plane->normal.y, plane->normal.z);
 					plane->normal.Normalize();
 
-					/* Fill in distance along plane normal */
-					token = strtok(NULL, " ,");
-					plane->distance = strtof(token, NULL);
-
-					plane->SetOnGeom();
+					plane->SetPoint();
 
 					/* Fill in plane Pigment */
-					povray->getline(line, 99);
-					fillPigment(line, plane);
+					objectLine(povray, line, &lineNumber);
+					pigment = Pigment();
+					if (!fillPigment(line, &pigment))
+						return parseError(lineNumber, "pigment {color rgb <r, g, b>}");
 
 					/* Fill in plane Finish */
-					povray->getline(line, 99);
-					fillFinish(line, plane);
-
-					/* Add plane to vector list of Geometry */
-					allGeometry->push_back(plane);
+					objectLine(povray, line, &lineNumber);
+					finish = Finish();
+					if (!fillFinish(line, &finish))
+						return parseError(lineNumber, "a value after each finish keyword");
+					plane->materials = &scene->materials;
+					plane->material = scene->materials.Intern(&pigment, &finish);
 				}
 				else if (!strcmp(token, "triangle")) {
 					triangle = new Triangle();
-
-					/* Fill in triangle vertexA */
-					povray->getline(line, 99);
-					token = strtok(line, " \t{<,");
-					triangle->vertexA.x = strtof(token, NULL);
-					token = strtok(NULL, " ,");
-					triangle->vertexA.y = strtof(token, NULL);
-					token = strtok(NULL, " ,>");
-					triangle->vertexA.z = strtof(token, NULL);
-
-					/* Fill in triangle vertexB */
-					povray->getline(line, 99);
-					token = strtok(line, " \t{<,");
-					triangle->vertexB.x = strtof(token, NULL);
-					token = strtok(NULL, " ,");
-					triangle->vertexB.y = strtof(token, NULL);
-					token = strtok(NULL, " ,>");
-					triangle->vertexB.z = strtof(token, NULL);
-
-					/* Fill in triangle vertexC */
-					povray->getline(line, 99);
-					token = strtok(line, " \t{<,");
-					triangle->vertexC.x = strtof(token, NULL);
-					token = strtok(NULL, " ,");
-					triangle->vertexC.y = strtof(token, NULL);
-					token = strtok(NULL, " ,>");
-					triangle->vertexC.z = strtof(token, NULL);
+					triangle->line = startLine;
+					scene->allGeometry.push_back(triangle);
+
+					/* Fill in triangle vertexA, vertexB and vertexC, a line each */
+					Point *vertices[3] = {&triangle->vertexA, &triangle->vertexB, &triangle->vertexC};
+					for (int v = 0; v < 3; v++) {
+						objectLine(povray, line, &lineNumber);
+						if (!floatToken(line, " \t{<,", &rest, &vertices[v]->x) || !floatToken(NULL, " ,", &rest, &vertices[v]->y) ||
+							!floatToken(NULL, " ,>", &rest, &vertices[v]->z))
+							return parseError(lineNumber, "a triangle vertex <x, y, z>");
+					}
 
 					triangle->SetVectors();
 
 					/* Fill in triangle Pigment */
-					povray->getline(line, 99);
-					fillPigment(line, triangle);
-
-					/* Fill in plane Finish */
-					povray->getline(line, 99);
-					fillFinish(line, triangle);
-
-					/* Add plane to vector list of Geometry */
-					allGeometry->push_back(triangle);
+					objectLine(povray, line, &lineNumber);
+					pigment = Pigment();
+					if (!fillPigment(line, &pigment))
+						return parseError(lineNumber, "pigment {color rgb <r, g, b>}");
+
+					/* Fill in triangle Finish */
+					objectLine(povray, line, &lineNumber);
+					finish = Finish();
+					if (!fillFinish(line, &finish))
+						return parseError(lineNumber, "a value after each finish keyword");
+					triangle->materials = &scene->materials;
+					triangle->material = scene->materials.Intern(&pigment, &finish);
 				}
 			}
 		}
 	}
+
+	return 0;
 }
 
-void fillFinish(char *line, Geometry *geom) {
-	char finishLine[100], *token;
+bool fillFinish(char *line, Finish *finish) {
+	char finishLine[100], *token, *rest;
+	float *value;
 
 	for (int i = 0, j = 0; i < 100; i++) {
 		if (line[i] != '{' && line[i] != '}')
 			finishLine[j++] = line[i];
 	}
 
-	token = strtok(finishLine, " \t");
-
-	while ((token = strtok(NULL, " \t"))) {
-		if (!geom->finish.ambient && !strcmp(token, "ambient")) {
-			token = strtok(NULL, " \t");
-			geom->finish.ambient = strtof(token, NULL);
-		}
-		else if (!geom->finish.diffuse && !strcmp(token, "diffuse")) {
-			token = strtok(NULL, " \t");
-			geom->finish.diffuse = strtof(token, NULL);
-		}
-		else if (!geom->finish.specular && !strcmp(token, "specular")) {
-			token = strtok(NULL, " \t");
-			geom->finish.specular = strtof(token, NULL);
-		}
-		else if (!strcmp(token, "roughness")) {
-			token = strtok(NULL, " \t");
-			geom->finish.roughness = strtof(token, NULL);
-		}						
-		else if (!geom->finish.refract && !strcmp(token, "refraction")) {
-			token = strtok(NULL, " \t");
-			geom->finish.refract = strtof(token, NULL);
-		}
-		else if (!geom->finish.reflect && !strcmp(token, "reflection")) {
-			token = strtok(NULL, " \t");
-			geom->finish.reflect = strtof(token, NULL);
-		}
-		else if (!geom->finish.ior && !strcmp(token, "ior")) {
-			token = strtok(NULL, " \t");
-			geom->finish.ior = strtof(token, NULL);
-		}
+	token = strtok_r(finishLine, " \t", &rest);
+
+	/* Only the first of each term counts, roughness takes the last */
+	while ((token = strtok_r(NULL, " \t", &rest))) {
+		if (!finish->ambient && !strcmp(token, "ambient"))
+			value = &finish->ambient;
+		else if (!finish->diffuse && !strcmp(token, "diffuse"))
+			value = &finish->diffuse;
+		else if (!finish->specular && !strcmp(token, "specular"))
+			value = &finish->specular;
+		else if (!strcmp(token, "roughness"))
+			value = &finish->roughness;
+		else if (!finish->refract && !strcmp(token, "refraction"))
+			value = &finish->refract;
+		else if (!finish->reflect && !strcmp(token, "reflection"))
+			value = &finish->reflect;
+		else if (!finish->ior && !strcmp(token, "ior"))
+			value = &finish->ior;
+		else
+			continue;
+
+		if (!floatToken(NULL, " \t", &rest, value))
+			return false;
 	}
+
+	return true;
 }
 
-void fillPigment(char *line, Geometry *geom) {
+bool fillPigment(char *line, Pigment *pigment) {
 	int rgbf;
-	char *token;
+	char *token, *rest;
 
-	token = strtok(line, "pigment {");
-	token = strtok(NULL, " ");
+	token = strtok_r(line, "pigment {", &rest);
+	token = strtok_r(NULL, " ", &rest);
 
 	/* Determine if Pigment is rgb or rgbf */
+	if (!token)
+		return false;
 	rgbf = !strcmp(token, "rgbf");
 
-	token = strtok(NULL, " <,");
-	geom->pigment.r = strtof(token, NULL);
-	token = strtok(NULL, " ,");
-	geom->pigment.g = strtof(token, NULL);
-	token = strtok(NULL, " ,>}");
-	geom->pigment.b = strtof(token, NULL);
-
-	if (rgbf) {
-		token = strtok(NULL, " ,>}");
-		geom->pigment.f = strtof(token, NULL);
-	}
-	else
-		geom->pigment.f = 0;
-}
-
+	if (!floatToken(NULL, " <,", &rest, &pigment->r) || !floatToken(NULL, " ,", &rest, &pigment->g) ||
+		!floatToken(NULL, " ,>}", &rest, &pigment->b))
+		return false;
 
+	if (rgbf)
+		return floatToken(NULL, " ,>}", &rest, &pigment->f);
 
+	pigment->f = 0;
+	return true;
+}
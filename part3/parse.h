@@ -1,14 +1,22 @@
 #pragma once
 #include <vector>
+#include <fstream>
 #include "objs.h"
+#include "options.h"
+#include "scene.h"
 using namespace std;
 
 /* Open .pov file, fill in variables, and create geometry */
-int fileOps(int argc, char *argv[], int *width, int *height, vector<Geometry *> *allGeometry, Camera *camera, Light *light);
+int fileOps(Options *options, Scene *scene);
 
-/* Once .pov file is open, parse through */
-void parse(fstream *povray, vector<Geometry *> *allGeometry, Camera *camera, Light *light);
+/* Same, from .pov text received rather than read from options->fileName */
+int sceneFromText(Options *options, Scene *scene, string *text);
 
-void fillFinish(char *line, Geometry *geom);
+/* Once .pov file is open, parse through. Returns 1, with the line printed, if a line is */
+/* missing something its object needs */
+int parse(istream *povray, Scene *scene);
 
-void fillPigment(char *line, Geometry *geom);
\ No newline at end of file
+/* Fill in from a finish or pigment line; false if a value is missing */
+bool fillFinish(char *line, Finish *finish);
+
+bool fillPigment(char *line, Pigment *pigment);
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include "pathtrace.h"
+#include "objs.h"
+#include "scene.h"
+#include "lights.h"
+#include "sampler.h"
+#include "timer.h"
+#include "options.h"
+#include "Image.h"
+#include "render.h"
+#include "checkpoint.h"
+#include <iostream>
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+/* Sampler dimensions used by a path: the pixel position, then a block for each bounce, */
+/* laid out so numbers used together share a Sobol pair (see sampler.h) */
+enum PathDimension { PATH_PIXEL_X, PATH_PIXEL_Y, PATH_BOUNCE };
+enum BounceDimension { BOUNCE_DIRECTION_U, BOUNCE_DIRECTION_V, BOUNCE_LIGHT, BOUNCE_PICK, BOUNCE_ROULETTE, BOUNCE_UNUSED, BOUNCE_DIMENSIONS };
+
+/* Shared clock for the time budget */
+static Timer pathClock;
+
+PathTracer::PathTracer(Scene *scene, Options *options) {
+	this->scene = scene;
+	this->options = options;
+	width = options->width;
+	height = options->height;
+	sum.assign(width * height, Pigment(0, 0, 0));
+	luminance.assign(width * height, 0);
+	luminanceSquared.assign(width * height, 0);
+	samples.assign(width * height, 0);
+	done.assign(width * height, false);
+	Tile region = renderRegion(options);
+	tiles = spiralTiles(&region, options->tileSize);
+	rays = 0;
+}
+
+static float brightness(Pigment *pigment) {
+	return (pigment->r + pigment->g + pigment->b) / 3;
+}
+
+/* Unit vector around axis from (u1, u2): cosine weighted when exponent is 0, otherwise a Phong lobe cos^exponent */
+static Vector sampleLobe(Vector *axis, float exponent, float u1, float u2) {
+	float cosTheta = exponent ? pow(u1, 1 / (exponent + 1)) : sqrt(u1), sinTheta = sqrt(max(0.0f, 1 - cosTheta * cosTheta));
+	float phi = 2 * M_PI * u2;
+
+	/* Any two unit vectors perpendicular to axis and each other */
+	Vector helper = fabs(axis->x) > 0.5 ? Vector(0, 1, 0) : Vector(1, 0, 0), u, v;
+	axis->Cross(&helper, &u);
+	u.Normalize();
+	axis->Cross(&u, &v);
+
+	Vector result = Vector(u.x * cos(phi) * sinTheta + v.x * sin(phi) * sinTheta + axis->x * cosTheta,
+		u.y * cos(phi) * sinTheta + v.y * sin(phi) * sinTheta + axis->y * cosTheta,
+		u.z * cos(phi) * sinTheta + v.z * sin(phi) * sinTheta + axis->z * cosTheta);
+	result.Normalize();
+	return result;
+}
+
+/* Next event estimation: one light picked uniformly (by choice, 0 -> 1) from those in range, */
+/* Blinn Phong at point toward it if unshadowed, divided by the pick probability */
+Pigment PathTracer::DirectLight(Geometry *hit, Material *m, Point *point, Vector *normal, Vector *view, int i, int j, float choice) {
+	static thread_local vector<Light *> nearby;
+	float zero = 0;
+
+	nearby.clear();
+	scene->lightTree.Query(point, &nearby);
+	if (nearby.empty())
+		return Pigment(0, 0, 0);
+
+	Light *light = nearby[min((int) (choice * nearby.size()), (int) nearby.size() - 1)];
+	Vector lightVector = Vector(light->center.x - point->x, light->center.y - point->y, light->center.z - point->z);
+	float distance = lightVector.magnitude;
+	lightVector.Normalize();
+
+	float lambert = normal->Dot(&lightVector);
+	if (lambert <= 0 || !lightVisible(&scene->allGeometry, i, j, point, light))
+		return Pigment(0, 0, 0);
+
+	float scale = light->Attenuation(distance) * nearby.size();
+	Pigment result = Pigment(m->diffuse.r * light->pigment.r * lambert * scale, m->diffuse.g * light->pigment.g * lambert * scale,
+		m->diffuse.b * light->pigment.b * lambert * scale);
+
+	if (hit->Specular()) {
+		Vector half = Vector(view->x + lightVector.x, view->y + lightVector.y, view->z + lightVector.z);
+		half.Normalize();
+
+		float highlight = pow(max(half.Dot(normal), zero), m->shiny) * scale;
+		result += Pigment(m->specular.r * light->pigment.r * highlight, m->specular.g * light->pigment.g * highlight,
+			m->specular.b * light->pigment.b * highlight);
+	}
+
+	return result;
+}
+
+/* One path through pixel (i, j). At each hit the local part of the material gets direct light */
+/* from DirectLight, then a single continuation is picked in proportion to its weight: */
+/* diffuse (cosine sampled), glossy (Phong lobe around the mirror direction, spheres only like */
+/* BlinnPhong), mirror reflection, or refraction. Light colors stand for point lights of */
+/* intensity pi * color, which keeps direct lighting as bright as the Whitted renderer. */
+/* Paths past three bounces continue with probability equal to their throughput */
+Pigment PathTracer::TracePath(int i, int j, int sample) {
+	Pigment radiance = Pigment(0, 0, 0), throughput = Pigment(1, 1, 1);
+
+	PixelSampler sampler = PixelSampler(options->sampler, i, j, sample);
+	Ray ray = Ray(i, j, sampler.Get(PATH_PIXEL_X), sampler.Get(PATH_PIXEL_Y), width, height, &scene->camera);
+	raysTraced++;
+
+	for (int depth = 0; depth <= options->maxDepth; depth++) {
+		int base = PATH_BOUNCE + depth * BOUNCE_DIMENSIONS;
+		float distance = 10000;
+		Geometry *hit = closestHit(&scene->allGeometry, i, j, &ray, &distance);
+
+		if (!hit)
+			break;
+
+		Material *m = hit->GetMaterial();
+		Point point = Point(&ray, distance);
+		Vector normal = hit->NormalAt(&point);
+		Vector view = Vector(-ray.direction.x, -ray.direction.y, -ray.direction.z);
+		view.Normalize();
+
+		float reflect = m->finish.reflect, filter = 0, fresnel = 1;
+		bool inside = false;
+		Ray refracted;
+
+		if (m->finish.refract && m->pigment.f) {
+			filter = m->finish.refract * m->pigment.f;
+			inside = view.Dot(&normal) < 0;
+			fresnel = refractRay(&ray, &point, &normal, m->finish.ior ? m->finish.ior : 1, &refracted);
+
+			/* Filtered on the way in, only split by Fresnel on the way out */
+			if (inside) {
+				reflect = 0;
+				filter = 1;
+			}
+		}
+
+		/* Shade the side the ray arrived from */
+		if (view.Dot(&normal) < 0)
+			normal *= -1;
+
+		float local = inside ? 0 : max(1 - reflect - filter, 0.0f);
+		if (local > 0) {
+			Pigment direct = DirectLight(hit, m, &point, &normal, &view, i, j, sampler.Get(base + BOUNCE_LIGHT));
+			radiance += Pigment(throughput.r * direct.r, throughput.g * direct.g, throughput.b * direct.b) * local;
+		}
+
+		float diffuseWeight = local * brightness(&m->diffuse), glossyWeight = hit->Specular() ? local * brightness(&m->specular) : 0;
+		float mirrorWeight = reflect + filter * fresnel, refractWeight = filter * (1 - fresnel);
+		float total = diffuseWeight + glossyWeight + mirrorWeight + refractWeight, pick = sampler.Get(base + BOUNCE_PICK) * total;
+		Vector direction;
+
+		if (total <= 0)
+			break;
+
+		Vector mirror = Vector(ray.direction.x + 2 * view.Dot(&normal) * normal.x, ray.direction.y + 2 * view.Dot(&normal) * normal.y,
+			ray.direction.z + 2 * view.Dot(&normal) * normal.z);
+		mirror.Normalize();
+
+		if (pick < diffuseWeight) {
+			direction = sampleLobe(&normal, 0, sampler.Get(base + BOUNCE_DIRECTION_U), sampler.Get(base + BOUNCE_DIRECTION_V));
+			throughput = throughput * m->diffuse * (local * total / diffuseWeight);
+		}
+		else if (pick < diffuseWeight + glossyWeight) {
+			direction = sampleLobe(&mirror, m->shiny, sampler.Get(base + BOUNCE_DIRECTION_U), sampler.Get(base + BOUNCE_DIRECTION_V));
+			if (direction.Dot(&normal) <= 0)
+				break;
+			throughput = throughput * m->specular * (local * total / glossyWeight);
+		}
+		else if (pick < diffuseWeight + glossyWeight + mirrorWeight) {
+			direction = mirror;
+			throughput = throughput * (total);
+		}
+		else {
+			direction = refracted.direction;
+			direction.Normalize();
+			throughput = throughput * total;
+			if (!inside)
+				throughput = throughput * m->pigment;
+		}
+
+		/* Russian roulette */
+		if (depth >= 3) {
+			float survive = min(max(throughput.r, max(throughput.g, throughput.b)), 0.95f);
+
+			if (sampler.Get(base + BOUNCE_ROULETTE) >= survive)
+				break;
+			throughput = throughput * (1 / survive);
+		}
+
+		ray = Ray(&point, &direction);
+		raysTraced++;
+	}
+
+	return radiance;
+}
+
+/* Relative standard error of the pixel's brightness under options->noise, with enough samples to trust it */
+bool PathTracer::Converged(int pixel) {
+	int n = samples[pixel];
+
+	if (!options->noise || n < 16)
+		return false;
+
+	double mean = luminance[pixel] / n, variance = max(0.0, luminanceSquared[pixel] / n - mean * mean);
+	return sqrt(variance / n) / max(mean, 0.01) < options->noise;
+}
+
+/* One sample for every unconverged pixel, tiles handed out by the work stealing scheduler */
+void PathTracer::Pass(double deadlineMs) {
+	int threads = renderThreads(options);
+	TileScheduler scheduler(tiles.size(), threads);
+
+	rays += runTiles(&tiles, &scheduler, threads, NULL, "render", [this, deadlineMs](int worker, Tile *tile) {
+		if (deadlineMs && pathClock.Milliseconds() > deadlineMs)
+			return;
+
+		for (int i = tile->x0; i < tile->x1; i++) {
+			for (int j = tile->y0; j < tile->y1; j++) {
+				int pixel = i * height + j;
+
+				if (done[pixel] || samples[pixel] >= options->pathSamples)
+					continue;
+
+				Pigment color = TracePath(i, j, samples[pixel]);
+				double value = brightness(&color);
+
+				sum[pixel].r += color.r;
+				sum[pixel].g += color.g;
+				sum[pixel].b += color.b;
+				luminance[pixel] += value;
+				luminanceSquared[pixel] += value * value;
+				samples[pixel]++;
+			}
+		}
+	});
+}
+
+/* Every per pixel array as it stands */
+void PathTracer::Save(string *state) {
+	state->append((const char *) sum.data(), sum.size() * sizeof(Pigment));
+	state->append((const char *) luminance.data(), luminance.size() * sizeof(double));
+	state->append((const char *) luminanceSquared.data(), luminanceSquared.size() * sizeof(double));
+	state->append((const char *) samples.data(), samples.size() * sizeof(int));
+	state->append(done.data(), done.size());
+}
+
+/* Load Save's state; false if it's damaged. Each pixel picks up at its next sample index */
+bool PathTracer::Restore(string *state) {
+	const char *next = state->data();
+	int pixels = width * height;
+
+	if (state->size() != pixels * (sizeof(Pigment) + 2 * sizeof(double) + sizeof(int) + 1))
+		return false;
+
+	memcpy(sum.data(), next, pixels * sizeof(Pigment));
+	next += pixels * sizeof(Pigment);
+	memcpy(luminance.data(), next, pixels * sizeof(double));
+	next += pixels * sizeof(double);
+	memcpy(luminanceSquared.data(), next, pixels * sizeof(double));
+	next += pixels * sizeof(double);
+	memcpy(samples.data(), next, pixels * sizeof(int));
+	next += pixels * sizeof(int);
+	memcpy(done.data(), next, pixels);
+	return true;
+}
+
+void PathTracer::Render(Image *img, Checkpoint *checkpoint) {
+	double start = pathClock.Milliseconds(), deadline = options->timeBudget ? start + options->timeBudget * 1000 : 0;
+	Tile region = renderRegion(options);
+	int passes = 0, converged = 0, area = (region.x1 - region.x0) * (region.y1 - region.y0);
+	mutex stateLock;
+	long total = 0;
+	color_t color;
+
+	/* A pass cut short by --time-budget leaves some pixels a sample ahead, so the passes */
+	/* still to run are counted from the pixel furthest behind */
+	if (checkpoint && checkpoint->resumed.size()) {
+		if (Restore(&checkpoint->resumed)) {
+			passes = options->pathSamples;
+			for (int i = region.x0; i < region.x1; i++)
+				for (int j = region.y0; j < region.y1; j++)
+					if (!done[i * height + j])
+						passes = min(passes, samples[i * height + j]);
+
+			printf("Resuming from %s at %d samples per pixel.\n", checkpoint->fileName.c_str(), passes);
+		}
+		else
+			cout << "Error. Checkpoint " << checkpoint->fileName << " is damaged, starting from the beginning." << endl;
+	}
+
+	/* Sums are only consistent between passes, so a snapshot waits for the pass to end and */
+	/* the next pass waits for the copy, not for the disk */
+	if (checkpoint)
+		checkpoint->Start([&](string *state) {
+			lock_guard<mutex> guard(stateLock);
+			Save(state);
+		});
+
+	while (passes < options->pathSamples && converged < area) {
+		{
+			lock_guard<mutex> guard(stateLock);
+
+			/* The first pass always finishes so no pixel is left without a sample */
+			Pass(passes ? deadline : 0);
+			passes++;
+
+			converged = 0;
+			for (int i = region.x0; i < region.x1; i++) {
+				for (int j = region.y0; j < region.y1; j++) {
+					int p = i * height + j;
+
+					done[p] = done[p] || Converged(p);
+					converged += done[p];
+				}
+			}
+		}
+
+		if (deadline && pathClock.Milliseconds() > deadline)
+			break;
+	}
+
+	if (checkpoint)
+		checkpoint->Finish(passes >= options->pathSamples || converged >= area);
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			int pixel = i * height + j;
+			Pigment mean = Pigment(0, 0, 0);
+
+			if (samples[pixel])
+				mean = Pigment(sum[pixel].r / samples[pixel], sum[pixel].g / samples[pixel], sum[pixel].b / samples[pixel]);
+
+			mean.SetColorT(&color);
+			img->pixel(i, j, color);
+			total += samples[pixel];
+		}
+	}
+
+	/* Hand the workers' rays to this thread's count for the perf report */
+	raysTraced += rays;
+
+	printf("Path tracing: %d passes, %.1f samples per pixel, %.1f%% of pixels converged, %.2fs.\n", passes,
+		(double) total / area, 100.0 * converged / area, (pathClock.Milliseconds() - start) / 1000);
+}
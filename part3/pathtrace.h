@@ -0,0 +1,34 @@
+#pragma once
+#include "objs.h"
+#include "scene.h"
+#include "options.h"
+#include "Image.h"
+#include "render.h"
+#include <vector>
+using namespace std;
+
+/* Progressive Monte Carlo path tracing, the --path alternative to Geometry::Reflect. */
+/* Every pass adds one jittered path to each pixel that hasn't converged yet; passes */
+/* stop at --path-spp samples, when every pixel's noise is under --noise, or when */
+/* --time-budget runs out. Passes are split over --threads by tile. A checkpoint holds the */
+/* per pixel sums after whole passes */
+class PathTracer {
+public:
+	PathTracer(Scene *scene, Options *options);
+	void Render(Image *img, class Checkpoint *checkpoint);
+	void Save(string *state);
+	bool Restore(string *state);
+	Pigment TracePath(int i, int j, int sample);
+	Pigment DirectLight(Geometry *hit, Material *m, Point *point, Vector *normal, Vector *view, int i, int j, float choice);
+	void Pass(double deadlineMs);
+	bool Converged(int pixel);
+	Scene *scene;
+	Options *options;
+	int width, height;
+	vector<Pigment> sum; /* per pixel, i * height + j */
+	vector<double> luminance, luminanceSquared; /* for the noise estimate */
+	vector<int> samples;
+	vector<char> done;
+	vector<Tile> tiles;
+	long rays; /* traced by the workers */
+};
@@ -0,0 +1,187 @@
+#include "perf.h"
+#include "objs.h"
+#include "timer.h"
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+static const char *eventNames[PERF_EVENTS] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+
+/* Shared clock so samples from different threads line up */
+static Timer perfClock;
+
+PerfSample::PerfSample() {
+	phase = "";
+	thread = 0;
+	rays = 0;
+	ms = 0;
+
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		values[e] = 0;
+		valid[e] = false;
+	}
+}
+
+PerfCounters::PerfCounters() {
+	for (int e = 0; e < PERF_EVENTS; e++)
+		fds[e] = -1;
+	raysAtStart = 0;
+	msAtStart = 0;
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+	for (int e = 0; e < PERF_EVENTS; e++)
+		if (fds[e] >= 0)
+			close(fds[e]);
+#endif
+}
+
+/* Open each event separately, so a PMU missing one event (common in VMs) still gives the rest */
+bool PerfCounters::Open() {
+	bool any = false;
+#ifdef __linux__
+	uint64_t configs[PERF_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[e];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		/* pid 0, cpu -1: this thread, wherever it runs */
+		fds[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		any |= fds[e] >= 0;
+	}
+#endif
+	return any;
+}
+
+void PerfCounters::Start(const char *phase, int thread) {
+	current = PerfSample();
+	current.phase = phase;
+	current.thread = thread;
+	raysAtStart = raysTraced;
+	msAtStart = perfClock.Milliseconds();
+
+#ifdef __linux__
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		if (fds[e] >= 0) {
+			ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+/* Stop counting and return the phase's sample, scaled up if the kernel multiplexed counters */
+PerfSample PerfCounters::Stop() {
+#ifdef __linux__
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		uint64_t data[3]; /* value, time enabled, time running */
+
+		if (fds[e] < 0)
+			continue;
+
+		ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fds[e], data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+			current.values[e] = (uint64_t) ((double) data[0] * data[1] / data[2]);
+			current.valid[e] = true;
+		}
+	}
+#endif
+	current.rays = raysTraced - raysAtStart;
+	current.ms = perfClock.Milliseconds() - msAtStart;
+	return current;
+}
+
+void PerfLog::Add(PerfSample sample) {
+	lock_guard<mutex> guard(lock);
+	samples.push_back(sample);
+}
+
+/* Print one table row, n/a wherever a counter is missing */
+static void printRow(PerfSample *sample, const char *thread) {
+	printf("%-8s %6s %10.2f %10ld", sample->phase.c_str(), thread, sample->ms, sample->rays);
+
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		if (sample->valid[e])
+			printf(" %14llu", (unsigned long long) sample->values[e]);
+		else
+			printf(" %14s", "n/a");
+	}
+
+	if (sample->valid[PERF_CYCLES] && sample->valid[PERF_INSTRUCTIONS] && sample->values[PERF_CYCLES])
+		printf(" %6.2f", (double) sample->values[PERF_INSTRUCTIONS] / sample->values[PERF_CYCLES]);
+	else
+		printf(" %6s", "n/a");
+
+	for (int e = PERF_CACHE_MISSES; e <= PERF_BRANCH_MISSES; e++) {
+		if (sample->valid[e] && sample->rays)
+			printf(" %12.3f", (double) sample->values[e] / sample->rays);
+		else
+			printf(" %12s", "n/a");
+	}
+	printf("\n");
+}
+
+/* One row per phase and thread, plus a total row for phases measured on several threads */
+void PerfLog::Print() {
+	vector<string> phases;
+
+	printf("%-8s %6s %10s %10s", "phase", "thread", "ms", "rays");
+	for (int e = 0; e < PERF_EVENTS; e++)
+		printf(" %14s", eventNames[e]);
+	printf(" %6s %12s %12s\n", "IPC", "cache/ray", "branch/ray");
+
+	for (int s = 0; s < samples.size(); s++)
+		if (find(phases.begin(), phases.end(), samples[s].phase) == phases.end())
+			phases.push_back(samples[s].phase);
+
+	for (int p = 0; p < phases.size(); p++) {
+		PerfSample total;
+		int threads = 0;
+		char thread[16];
+
+		total.phase = phases[p];
+		for (int e = 0; e < PERF_EVENTS; e++)
+			total.valid[e] = true;
+
+		for (int s = 0; s < samples.size(); s++) {
+			PerfSample *sample = &samples[s];
+
+			if (sample->phase != phases[p])
+				continue;
+
+			snprintf(thread, sizeof(thread), "%d", sample->thread);
+			printRow(sample, thread);
+			threads++;
+
+			/* Threads overlap, so the phase's wall time is the longest one */
+			total.ms = sample->ms > total.ms ? sample->ms : total.ms;
+			total.rays += sample->rays;
+			for (int e = 0; e < PERF_EVENTS; e++) {
+				total.values[e] += sample->values[e];
+				total.valid[e] = total.valid[e] && sample->valid[e];
+			}
+		}
+
+		if (threads > 1)
+			printRow(&total, "all");
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+using namespace std;
+
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS };
+
+/* Counter values, time and ray count for one phase on one thread */
+class PerfSample {
+public:
+	PerfSample();
+	string phase;
+	int thread;
+	uint64_t values[PERF_EVENTS];
+	bool valid[PERF_EVENTS]; /* false when the event couldn't be opened or never ran */
+	long rays;
+	double ms;
+};
+
+/* Hardware counters for the calling thread, via Linux perf_event_open */
+/* Open() must be called on the thread being measured; everything degrades to timing only elsewhere */
+class PerfCounters {
+public:
+	PerfCounters();
+	~PerfCounters();
+	bool Open();
+	void Start(const char *phase, int thread);
+	PerfSample Stop();
+	int fds[PERF_EVENTS];
+	PerfSample current;
+	long raysAtStart;
+	double msAtStart;
+};
+
+/* Collects samples from every thread and prints IPC and misses per ray */
+class PerfLog {
+public:
+	void Add(PerfSample sample);
+	void Print();
+	vector<PerfSample> samples;
+	mutex lock;
+};
@@ -0,0 +1,83 @@
+#include "profile.h"
+#include "objs.h"
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+bool profiling = false;
+thread_local ObjectCost *localCosts = NULL;
+thread_local uint64_t feelerTicks = 0;
+
+static int profiledObjects = 0;
+static vector<unique_ptr<ObjectCost[]> > threadCosts; /* every thread's table, for printProfile to sum */
+static mutex threadCostsLock;
+
+ObjectCost::ObjectCost() {
+	tested = hits = occlusions = 0;
+	intersectTicks = shadeTicks = 0;
+}
+
+uint64_t ObjectCost::Total() {
+	return intersectTicks + shadeTicks;
+}
+
+void ObjectCost::Add(ObjectCost *other) {
+	tested += other->tested;
+	hits += other->hits;
+	occlusions += other->occlusions;
+	intersectTicks += other->intersectTicks;
+	shadeTicks += other->shadeTicks;
+}
+
+/* A thread's first profiled ray makes its table; the list keeps it after the thread ends */
+ObjectCost *newThreadCosts() {
+	lock_guard<mutex> guard(threadCostsLock);
+
+	threadCosts.push_back(unique_ptr<ObjectCost[]>(new ObjectCost[profiledObjects]));
+	localCosts = threadCosts.back().get();
+	return localCosts;
+}
+
+void startProfile(int objects) {
+	profiledObjects = objects;
+	profiling = true;
+}
+
+void printProfile(vector<Geometry *> *allGeometry, int topN, const char *fileName) {
+	vector<ObjectCost> costs(allGeometry->size());
+	vector<int> sorted(allGeometry->size());
+	uint64_t total = 0;
+
+	/* Rays traced after this (debug pixels) aren't counted */
+	profiling = false;
+
+	for (int t = 0; t < threadCosts.size(); t++)
+		for (int g = 0; g < costs.size(); g++)
+			costs[g].Add(&threadCosts[t][g]);
+	threadCosts.clear();
+	localCosts = NULL;
+
+	for (int g = 0; g < costs.size(); g++) {
+		total += costs[g].Total();
+		sorted[g] = g;
+	}
+
+	sort(sorted.begin(), sorted.end(), [&](int a, int b) { return costs[a].Total() > costs[b].Total(); });
+
+	printf("Most expensive objects in %s (%d of %d):\n", fileName, topN < sorted.size() ? topN : (int) sorted.size(), (int) sorted.size());
+	printf("%4s %6s %-9s %6s %12s %10s %10s %14s %14s %7s\n", "rank", "index", "type", "line", "tested", "hits",
+		"occluded", "intersect", "shade", "share");
+
+	for (int r = 0; r < topN && r < sorted.size(); r++) {
+		int index = sorted[r];
+		Geometry *geom = allGeometry->at(index);
+		ObjectCost *cost = &costs[index];
+
+		printf("%4d %6d %-9s %6d %12ld %10ld %10ld %14llu %14llu %6.2f%%\n", r + 1, index, geom->TypeName(), geom->line,
+			cost->tested, cost->hits, cost->occlusions, (unsigned long long) cost->intersectTicks,
+			(unsigned long long) cost->shadeTicks, total ? 100.0 * cost->Total() / total : 0.0);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "objs.h"
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+using namespace std;
+
+/* Cheap timestamp for per-object attribution; cycles on x86, nanoseconds elsewhere */
+static inline uint64_t profileClock() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/* Work attributed to one Geometry object by one thread, only allocated when profiling */
+class ObjectCost {
+public:
+	ObjectCost();
+	uint64_t Total();
+	void Add(ObjectCost *other);
+	long tested; /* Intersect calls, from any kind of ray */
+	long hits; /* times it was the closest hit and got shaded */
+	long occlusions; /* shadow feelers it blocked */
+	uint64_t intersectTicks; /* its Intersect calls, shadow feelers included */
+	uint64_t shadeTicks; /* shading it, less the feeler tests, which count against the objects tested */
+};
+
+extern bool profiling;
+extern thread_local ObjectCost *localCosts;
+extern thread_local uint64_t feelerTicks;
+
+ObjectCost *newThreadCosts();
+
+/* This thread's costs, indexed like allGeometry, or NULL when not profiling. Each thread */
+/* counts into its own table, so profiling adds no contention between threads */
+static inline ObjectCost *profileCosts() {
+	if (!profiling)
+		return NULL;
+	return localCosts ? localCosts : newThreadCosts();
+}
+
+/* Turn on the counting paths in objs.cpp for a scene of that many objects */
+void startProfile(int objects);
+
+/* Sum every thread's costs and print the topN objects by intersect + shade time, with */
+/* their .pov source lines. Profiling stops and the tables are freed */
+void printProfile(vector<Geometry *> *allGeometry, int topN, const char *fileName);
@@ -0,0 +1,91 @@
+#include "progressive.h"
+#include "render.h"
+#include "scene.h"
+#include "objs.h"
+#include "timer.h"
+#include "options.h"
+#include "Image.h"
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+/* True when pixel (i, j), counted from the region's corner, is first traced at the level with this step */
+static bool newAtLevel(int i, int j, int step) {
+	if (i % step || j % step)
+		return false;
+
+	return step == PREVIEW_STEP || (i % (2 * step)) || (j % (2 * step));
+}
+
+/* Copy colors into img; a fresh Image each time so its brightness scale only sees this preview */
+static void writePreview(Options *options, vector<Pigment> *colors) {
+	Image preview(options->width, options->height);
+	color_t color;
+
+	for (int i = 0; i < options->width; i++) {
+		for (int j = 0; j < options->height; j++) {
+			(*colors)[i * options->height + j].SetColorT(&color);
+			preview.pixel(i, j, color);
+		}
+	}
+
+	writeRender(options, &preview);
+}
+
+void renderProgressive(Scene *scene, Options *options, Image *img) {
+	int width = options->width, height = options->height, threads = renderThreads(options);
+	Tile region = renderRegion(options);
+	vector<Tile> tiles = spiralTiles(&region, options->tileSize);
+	vector<Pigment> colors(width * height);
+	Timer timer;
+	double lastWrite = 0;
+	color_t color;
+
+	/* Tiles go to the scheduler a batch at a time, so previews can be written between batches */
+	int batch = max(threads * 8, 1);
+
+	for (int step = PREVIEW_STEP; step >= 1; step /= 2) {
+		for (int first = 0; first < tiles.size(); first += batch) {
+			vector<Tile> part(tiles.begin() + first, tiles.begin() + min(first + batch, (int) tiles.size()));
+			TileScheduler scheduler(part.size(), threads);
+
+			/* Blocks of new pixels never overlap, so workers can fill them in directly */
+			raysTraced += runTiles(&part, &scheduler, threads, NULL, "render", [&](int worker, Tile *tile) {
+				for (int i = tile->x0; i < tile->x1; i++) {
+					for (int j = tile->y0; j < tile->y1; j++) {
+						if (!newAtLevel(i - region.x0, j - region.y0, step))
+							continue;
+
+						Pigment pixel = scene->TracePixel(i, j, width, height, options->samples, options->maxDepth);
+
+						for (int bi = i; bi < min(i + step, region.x1); bi++)
+							for (int bj = j; bj < min(j + step, region.y1); bj++)
+								colors[bi * height + bj] = pixel;
+					}
+				}
+			});
+
+			if (options->previewInterval && timer.Seconds() - lastWrite > options->previewInterval && first + batch < tiles.size()) {
+				writePreview(options, &colors);
+				lastWrite = timer.Seconds();
+			}
+		}
+
+		/* The full level is written by the caller like any other render */
+		if (step > 1) {
+			writePreview(options, &colors);
+			lastWrite = timer.Seconds();
+			printf("Preview at 1/%d resolution written after %.3fs.\n", step, lastWrite);
+		}
+		else
+			printf("Full resolution done after %.3fs.\n", timer.Seconds());
+	}
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			colors[i * height + j].SetColorT(&color);
+			img->pixel(i, j, color);
+		}
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "scene.h"
+#include "options.h"
+#include "Image.h"
+using namespace std;
+
+/* Coarsest preview level: one ray per PREVIEW_STEP x PREVIEW_STEP block */
+const int PREVIEW_STEP = 8;
+
+/* Whitted render in levels of 1/8, 1/4, 1/2 and full resolution. Each level traces only */
+/* the pixels no coarser level traced and fills the rest of their block with the result, */
+/* so the full level ends with exactly the image renderTiles makes, every pixel traced once. */
+/* The preview is written to options->output after every level, and within a level */
+/* whenever options->previewInterval seconds have passed */
+void renderProgressive(Scene *scene, Options *options, Image *img);
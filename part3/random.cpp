@@ -0,0 +1,38 @@
+#include "random.h"
+#include <stdint.h>
+using namespace std;
+
+thread_local Random shadingRandom;
+
+Random::Random() {
+	Seed(1);
+}
+
+Random::Random(uint64_t seed) {
+	Seed(seed);
+}
+
+void Random::Seed(uint64_t seed) {
+	state = seed * 2685821657736338717ULL + 1;
+}
+
+/* Mix pixel coordinates and sample number into one seed (splitmix64 finalizer) */
+void Random::Seed(int i, int j, int sample) {
+	uint64_t z = ((uint64_t) (uint32_t) i << 40) ^ ((uint64_t) (uint32_t) j << 20) ^ (uint32_t) sample;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	Seed(z ^ (z >> 31));
+}
+
+/* Return a float in [0, 1) */
+float Random::Uniform() {
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return ((state * 2685821657736338717ULL) >> 40) / (float) (1 << 24);
+}
+
+float Random::Range(float low, float high) {
+	return low + (high - low) * Uniform();
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+using namespace std;
+
+/* xorshift64*, so a seed gives the same numbers on every platform (unlike rand()) */
+class Random {
+public:
+	Random();
+	Random(uint64_t seed);
+	void Seed(uint64_t seed);
+	void Seed(int i, int j, int sample);
+	float Uniform();
+	float Range(float low, float high);
+	uint64_t state;
+};
+
+/* Per-thread generator for shading decisions, seeded per pixel sample so renders */
+/* don't depend on which thread traced what */
+extern thread_local Random shadingRandom;
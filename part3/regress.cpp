@@ -0,0 +1,121 @@
+#include "regress.h"
+#include "options.h"
+#include "Image.h"
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <string>
+using namespace std;
+
+Regression::Regression() {
+	maxError = 0;
+	psnr = INFINITY;
+	ms = baselineMs = 0;
+	imageChecked = timeChecked = false;
+	imageOk = timeOk = true;
+	maxAllowedError = 0;
+	minPsnr = 0;
+}
+
+/* Fill in maxError and psnr over every channel of every pixel, both images in 0.0 -> 1.0 */
+bool Regression::CompareImages(Image *render, Image *golden) {
+	double squared = 0, diff;
+	int channels = 0;
+
+	for (int x = 0; x < render->width(); x++) {
+		for (int y = 0; y < render->height(); y++) {
+			color_t a = render->pixel(x, y), b = golden->pixel(x, y);
+			double pairs[3][2] = {{a.r, b.r}, {a.g, b.g}, {a.b, b.b}};
+
+			for (int c = 0; c < 3; c++) {
+				diff = fabs(pairs[c][0] - pairs[c][1]) * 255;
+				squared += diff * diff;
+				channels++;
+
+				if (lround(diff) > maxError)
+					maxError = lround(diff);
+			}
+		}
+	}
+
+	psnr = squared ? 10 * log10(255.0 * 255.0 / (squared / channels)) : INFINITY;
+	imageChecked = true;
+	imageOk = maxError <= maxAllowedError && psnr >= minPsnr;
+	return imageOk;
+}
+
+/* A render a few ms over a short baseline is noise, not a regression, so the ratio only */
+/* counts once the difference passes slackMs */
+bool Regression::CompareTime(double ms, double baselineMs, float maxSlowdown, float slackMs) {
+	this->ms = ms;
+	this->baselineMs = baselineMs;
+	timeChecked = true;
+	timeOk = ms <= baselineMs * maxSlowdown || ms - baselineMs < slackMs;
+	return timeOk;
+}
+
+/* One line per check, prefixed PASS or FAIL */
+void Regression::Print() {
+	if (imageChecked) {
+		cout << (imageOk ? "PASS" : "FAIL") << " image: max channel error " << maxError << " (limit " << maxAllowedError << ")";
+		cout << ", PSNR " << psnr << " dB (limit " << minPsnr << ")" << endl;
+	}
+
+	if (timeChecked) {
+		cout << (timeOk ? "PASS" : "FAIL") << " time: " << ms << " ms, baseline " << baselineMs << " ms";
+		cout << " (" << ms / baselineMs << "x)" << endl;
+	}
+}
+
+int checkRegression(Options *options, double ms) {
+	Regression regression;
+	fstream baseline;
+
+	if (options->record) {
+		if (options->golden.size()) {
+			ifstream render(options->output, ios::binary);
+			ofstream golden(options->golden, ios::binary);
+			golden << render.rdbuf();
+			cout << "Recorded golden image " << options->golden << endl;
+		}
+
+		if (options->baseline.size()) {
+			baseline.open(options->baseline, fstream::out);
+			baseline << ms << endl;
+			cout << "Recorded baseline " << ms << " ms in " << options->baseline << endl;
+		}
+
+		return 0;
+	}
+
+	regression.maxAllowedError = options->maxError;
+	regression.minPsnr = options->minPsnr;
+
+	if (options->golden.size()) {
+		Image render(options->width, options->height), golden(options->width, options->height);
+
+		/* Compare what was actually written, so both sides went through the same 8 bit encoding */
+		if (!render.ReadTga((char *)options->output.c_str()) || !golden.ReadTga((char *)options->golden.c_str())) {
+			cout << "Error. Could not read " << options->golden << " as a " << options->width << "x" << options->height << " targa." << endl;
+			return 1;
+		}
+
+		regression.CompareImages(&render, &golden);
+	}
+
+	if (options->baseline.size()) {
+		double baselineMs = 0;
+
+		baseline.open(options->baseline, fstream::in);
+		if (!(baseline >> baselineMs) || baselineMs <= 0) {
+			cout << "Error. Could not read a baseline time from " << options->baseline << endl;
+			return 1;
+		}
+
+		regression.CompareTime(ms, baselineMs, options->maxSlowdown, options->timeSlack);
+	}
+
+	regression.Print();
+
+	return regression.imageOk && regression.timeOk ? 0 : 2;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "options.h"
+#include "Image.h"
+
+/* Golden image and timing check for one rendered scene */
+class Regression {
+public:
+	Regression();
+	bool CompareImages(Image *render, Image *golden);
+	bool CompareTime(double ms, double baselineMs, float maxSlowdown, float slackMs);
+	void Print();
+	int maxError; /* worst single channel difference, 0-255 */
+	double psnr; /* peak signal to noise ratio in dB, infinite for an exact match */
+	double ms, baselineMs;
+	bool imageChecked, timeChecked, imageOk, timeOk;
+	float maxAllowedError, minPsnr;
+};
+
+/* Compare the written render and its time against options->golden and options->baseline */
+/* With options->record, store them as the new golden image and baseline instead */
+/* Returns 0 if everything is within tolerance, 2 on a regression, 1 on a missing reference */
+int checkRegression(Options *options, double ms);
@@ -0,0 +1,410 @@
+#include "render.h"
+#include "scene.h"
+#include "parse.h"
+#include "objs.h"
+#include "options.h"
+#include "perf.h"
+#include "Image.h"
+#include "checkpoint.h"
+#include "budget.h"
+#include "timer.h"
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <vector>
+using namespace std;
+
+Tile::Tile() {
+	x0 = y0 = x1 = y1 = 0;
+}
+
+Tile::Tile(int x0, int y0, int x1, int y1) {
+	this->x0 = x0;
+	this->y0 = y0;
+	this->x1 = x1;
+	this->y1 = y1;
+}
+
+/* Where a tile falls in the spiral: its ring around the center tile, then the angle */
+class SpiralKey {
+public:
+	int ring;
+	float angle;
+	int tile;
+	bool operator<(const SpiralKey &other) const {
+		return ring != other.ring ? ring < other.ring : angle < other.angle;
+	}
+};
+
+vector<Tile> spiralTiles(Tile *area, int size) {
+	int width = area->x1 - area->x0, height = area->y1 - area->y0;
+	int columns = (width + size - 1) / size, rows = (height + size - 1) / size;
+	float centerX = (columns - 1) / 2.0, centerY = (rows - 1) / 2.0;
+	vector<SpiralKey> keys;
+	vector<Tile> tiles;
+
+	for (int tx = 0; tx < columns; tx++) {
+		for (int ty = 0; ty < rows; ty++) {
+			SpiralKey key;
+
+			key.ring = (int) ceil(max(fabs(tx - centerX), fabs(ty - centerY)));
+			key.angle = atan2(ty - centerY, tx - centerX);
+			key.tile = tiles.size();
+			keys.push_back(key);
+			tiles.push_back(Tile(area->x0 + tx * size, area->y0 + ty * size, area->x0 + min((tx + 1) * size, width),
+				area->y0 + min((ty + 1) * size, height)));
+		}
+	}
+
+	sort(keys.begin(), keys.end());
+
+	vector<Tile> ordered;
+	for (int k = 0; k < keys.size(); k++)
+		ordered.push_back(tiles[keys[k].tile]);
+	return ordered;
+}
+
+Tile renderRegion(Options *options) {
+	return Tile(options->regionX0, options->regionY0, options->regionX1, options->regionY1);
+}
+
+/* The brightest channel the full frame in out was divided by when it was written. Each of */
+/* the region's pixels there was written as (v / scale) * 255 rounded down, which bounds */
+/* scale; if those pixels haven't changed since, any scale inside every bound writes them */
+/* back byte for byte. If they have, the brightest byte gives the closest estimate */
+static double compositeScale(Image *img, Image *out, Tile *region) {
+	double low = 1, high = INFINITY, estimate = 0;
+	int brightest = 0;
+
+	for (int i = region->x0; i < region->x1; i++) {
+		for (int j = region->y0; j < region->y1; j++) {
+			color_t color = img->pixel(i, j), old = out->pixel(i, j);
+			double values[3] = {color.r, color.g, color.b};
+			int bytes[3] = {(int) lround(old.r * 255), (int) lround(old.g * 255), (int) lround(old.b * 255)};
+
+			for (int c = 0; c < 3; c++) {
+				if (values[c] <= 0)
+					continue;
+
+				low = max(low, 255 * values[c] / (bytes[c] + 1));
+				if (!bytes[c])
+					continue;
+
+				high = min(high, 255 * values[c] / bytes[c]);
+				if (bytes[c] > brightest) {
+					brightest = bytes[c];
+					estimate = 255 * values[c] / bytes[c];
+				}
+			}
+		}
+	}
+
+	/* Nothing in the window shows in out, so anything above low leaves it dark */
+	if (high == INFINITY)
+		return 2 * low;
+
+	return low < high ? (low + high) / 2 : estimate;
+}
+
+/* Write img to --output, returning 1 with the error printed if it can't be. A bad path is */
+/* the caller's to report, so --serve can tell the one client and carry on */
+static int writeTga(Image *img, Options *options, bool scale) {
+	if (img->WriteTga((char *) options->output.c_str(), scale))
+		return 0;
+
+	cout << "Error. Can't write " << options->output << ": " << strerror(errno) << endl;
+	return 1;
+}
+
+/* A full frame is scaled by its brightest channel. A composited region is scaled the way */
+/* its target was, so its pixels match a full render; a crop has no frame to match and is */
+/* written unscaled (clamped at 1) */
+int writeRender(Options *options, Image *img) {
+	Tile region = renderRegion(options);
+
+	if (!options->region)
+		return writeTga(img, options, true);
+
+	bool crop = !options->composite.size();
+	Image out(crop ? region.x1 - region.x0 : options->width, crop ? region.y1 - region.y0 : options->height);
+
+	if (!crop && !out.ReadTga((char *) options->composite.c_str())) {
+		cout << "Error. Can't read " << options->composite << " as a " << options->width << "x" << options->height << " image." << endl;
+		return 1;
+	}
+
+	double scale = crop ? 255 : compositeScale(img, &out, &region);
+
+	for (int i = region.x0; i < region.x1; i++) {
+		for (int j = region.y0; j < region.y1; j++) {
+			color_t color = img->pixel(i, j);
+
+			color.r /= scale;
+			color.g /= scale;
+			color.b /= scale;
+			out.pixel(crop ? i - region.x0 : i, crop ? j - region.y0 : j, color);
+		}
+	}
+
+	return writeTga(&out, options, false);
+}
+
+bool plainRender(Options *options) {
+	return !(options->path || options->deferred || options->progressive || options->aa || options->gbuffer.size() ||
+		options->denoise || options->listen.size() || options->worker.size() || options->batch.size() ||
+		options->serve.size() || options->server.size() || options->checkpoint.size() || options->golden.size() ||
+		options->baseline.size() || options->perf || options->profileTop || options->debugPixels.size());
+}
+
+bool TileQueue::Pop(int *tile) {
+	lock_guard<mutex> guard(lock);
+
+	if (tiles.empty())
+		return false;
+
+	*tile = tiles.front();
+	tiles.pop_front();
+	return true;
+}
+
+bool TileQueue::Steal(int *tile) {
+	lock_guard<mutex> guard(lock);
+
+	if (tiles.empty())
+		return false;
+
+	*tile = tiles.back();
+	tiles.pop_back();
+	return true;
+}
+
+int TileQueue::Size() {
+	lock_guard<mutex> guard(lock);
+	return tiles.size();
+}
+
+TileScheduler::TileScheduler(int tiles, int workers) : queues(workers) {
+	stolen = 0;
+
+	for (int t = 0; t < tiles; t++)
+		queues[t % workers].tiles.push_back(t);
+}
+
+/* Own tiles first, then steal; false once every queue is empty */
+bool TileScheduler::Next(int worker, int *tile) {
+	if (queues[worker].Pop(tile))
+		return true;
+
+	while (true) {
+		int victim = -1, most = 0;
+
+		for (int w = 0; w < queues.size(); w++) {
+			int size = queues[w].Size();
+
+			if (w != worker && size > most) {
+				victim = w;
+				most = size;
+			}
+		}
+
+		if (victim < 0)
+			return false;
+
+		/* Someone else may have emptied it since we looked */
+		if (queues[victim].Steal(tile)) {
+			stolen++;
+			return true;
+		}
+	}
+}
+
+int renderThreads(Options *options) {
+	return options->threads ? options->threads : max(1u, thread::hardware_concurrency());
+}
+
+long runTiles(vector<Tile> *tiles, TileScheduler *scheduler, int threads, PerfLog *perfLog, const char *phase,
+	function<void(int, Tile *)> work) {
+	vector<thread> workers;
+	atomic<long> rays;
+
+	rays = 0;
+	for (int t = 0; t < threads; t++) {
+		workers.push_back(thread([=, &rays]() {
+			PerfCounters counters;
+			int tile;
+
+			if (perfLog) {
+				counters.Open();
+				counters.Start(phase, t + 1);
+			}
+
+			while (scheduler->Next(t, &tile))
+				work(t, &tiles->at(tile));
+
+			if (perfLog)
+				perfLog->Add(counters.Stop());
+
+			/* raysTraced is per thread, and this one is about to end */
+			rays += raysTraced;
+		}));
+	}
+
+	for (int t = 0; t < workers.size(); t++)
+		workers[t].join();
+
+	return rays;
+}
+
+/* Drop the tiles a resumed checkpoint already finished, keeping the rest in spiral order */
+static void skipFinished(vector<Tile> *tiles, vector<Tile> *finished) {
+	vector<Tile> remaining;
+
+	for (int t = 0; t < tiles->size(); t++) {
+		Tile *tile = &tiles->at(t);
+		bool done = false;
+
+		for (int f = 0; f < finished->size() && !done; f++)
+			done = finished->at(f).x0 == tile->x0 && finished->at(f).y0 == tile->y0 && finished->at(f).x1 == tile->x1 &&
+				finished->at(f).y1 == tile->y1;
+
+		if (!done)
+			remaining.push_back(*tile);
+	}
+
+	tiles->swap(remaining);
+}
+
+/* Trace tile at a quality level: one pixel (its block's top left) per block x block square, */
+/* copied over the square. Level 0 traces exactly what the unbudgeted render does */
+static void traceTileAt(Scene *scene, Options *options, Tile *tile, QualityLevel *level, vector<Pigment> *colors) {
+	int width = options->width, height = options->height;
+
+	for (int i = tile->x0; i < tile->x1; i += level->block) {
+		for (int j = tile->y0; j < tile->y1; j += level->block) {
+			Pigment pixel = scene->TracePixel(i, j, width, height, level->samples, level->maxDepth);
+
+			for (int bi = i; bi < min(i + level->block, tile->x1); bi++)
+				for (int bj = j; bj < min(j + level->block, tile->y1); bj++)
+					colors->at(bi * height + bj) = pixel;
+		}
+	}
+}
+
+/* Relative work in each tile for the time budget: rays traced for one full depth sample */
+/* every PROBE_STEP pixels each way, times the tile's area. Every ray tests every object, */
+/* so rays are a fair measure of time, and counting them is free of timer noise */
+static const int PROBE_STEP = 8;
+
+static vector<double> probeTiles(Scene *scene, Options *options, vector<Tile> *tiles, int threads) {
+	TileScheduler scheduler(tiles->size(), threads);
+	vector<double> weights(tiles->size());
+
+	raysTraced += runTiles(tiles, &scheduler, threads, NULL, "probe", [&](int worker, Tile *tile) {
+		long before = raysTraced;
+		int probes = 0;
+
+		for (int i = tile->x0 + PROBE_STEP / 2; i < tile->x1; i += PROBE_STEP) {
+			for (int j = tile->y0 + PROBE_STEP / 2; j < tile->y1; j += PROBE_STEP) {
+				scene->TracePixel(i, j, options->width, options->height, 1, options->maxDepth);
+				probes++;
+			}
+		}
+
+		/* Tiles too small to hold a probe, and tiles of empty sky, still cost a ray a pixel */
+		double perPixel = probes ? (double) (raysTraced - before) / probes : 1;
+		weights[tile - &tiles->at(0)] = max(1.0, perPixel) * (tile->x1 - tile->x0) * (tile->y1 - tile->y0);
+	});
+
+	return weights;
+}
+
+void renderTiles(Scene *scene, Options *options, Image *img, PerfLog *perfLog, Checkpoint *checkpoint) {
+	int width = options->width, height = options->height, threads = renderThreads(options);
+	Tile region = renderRegion(options);
+	vector<Tile> tiles = spiralTiles(&region, options->tileSize), finished;
+	vector<Pigment> colors(width * height);
+	mutex finishedLock;
+	atomic<bool> degraded(false);
+	color_t color;
+
+	if (checkpoint && checkpoint->resumed.size()) {
+		if (readTiles(&checkpoint->resumed, &finished, &colors, height)) {
+			printf("Resuming from %s with %d of %d tiles done.\n", checkpoint->fileName.c_str(), (int) finished.size(),
+				(int) tiles.size());
+			skipFinished(&tiles, &finished);
+		}
+		else {
+			cout << "Error. Checkpoint " << checkpoint->fileName << " is damaged, starting from the beginning." << endl;
+			finished.clear();
+			fill(colors.begin(), colors.end(), Pigment());
+		}
+	}
+
+	TileScheduler scheduler(tiles.size(), threads);
+	vector<double> weights = options->timeBudget ? probeTiles(scene, options, &tiles, threads) : vector<double>();
+	double weight = 0;
+
+	for (int t = 0; t < weights.size(); t++)
+		weight += weights[t];
+	QualityControl quality(options, weight, threads);
+
+	/* Finished tiles never change again, so the writer thread only needs the list under the lock */
+	if (checkpoint)
+		checkpoint->Start([&](string *state) {
+			vector<Tile> snapshot;
+			{
+				lock_guard<mutex> guard(finishedLock);
+				snapshot = finished;
+			}
+			appendTiles(state, &snapshot, &colors, height);
+		});
+
+	runTiles(&tiles, &scheduler, threads, perfLog, "render", [&](int worker, Tile *tile) {
+		int level = 0;
+
+		if (options->timeBudget) {
+			double size = weights[tile - &tiles[0]];
+			Timer tileTimer;
+
+			level = quality.Choose(size);
+			traceTileAt(scene, options, tile, &quality.levels[level], &colors);
+			quality.Done(level, size, tileTimer.Milliseconds());
+		}
+		else {
+			for (int i = tile->x0; i < tile->x1; i++)
+				for (int j = tile->y0; j < tile->y1; j++)
+					colors[i * height + j] = scene->TracePixel(i, j, width, height, options->samples, options->maxDepth);
+		}
+
+		/* A tile rendered below full quality is left for a resumed render to redo */
+		if (level)
+			degraded = true;
+		else if (checkpoint) {
+			lock_guard<mutex> guard(finishedLock);
+			finished.push_back(*tile);
+		}
+	});
+
+	/* Kept while any tile still needs redoing at full quality, like an unconverged path render */
+	if (checkpoint)
+		checkpoint->Finish(!degraded);
+
+	/* Image::pixel tracks the brightest value, so pixels go in from this thread only */
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			colors[i * height + j].SetColorT(&color);
+			img->pixel(i, j, color);
+		}
+	}
+
+	if (options->timeBudget)
+		quality.Report();
+
+	if (perfLog)
+		printf("Tiles: %d of %dx%d on %d threads, %d stolen.\n", (int) tiles.size(), options->tileSize, options->tileSize, threads,
+			(int) scheduler.stolen);
+}
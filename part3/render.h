@@ -0,0 +1,70 @@
+#pragma once
+#include "scene.h"
+#include "options.h"
+#include "perf.h"
+#include "Image.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+/* Pixels [x0, x1) x [y0, y1) */
+class Tile {
+public:
+	Tile();
+	Tile(int x0, int y0, int x1, int y1);
+	int x0, y0, x1, y1;
+};
+
+/* size x size tiles covering area, in a square spiral out from its center so the middle */
+/* of the frame, where the subject usually is, finishes first */
+vector<Tile> spiralTiles(Tile *area, int size);
+
+/* The pixels options ask for: --region, or the whole frame */
+Tile renderRegion(Options *options);
+
+/* Write img (rendered at full frame size) to options->output: all of it, just the --region */
+/* window, or the window pasted into --composite. Return 1, with the error printed, if the */
+/* composite can't be read or the output can't be written */
+int writeRender(Options *options, Image *img);
+
+/* True when options ask for nothing but the default render written to --output (with */
+/* --region and --time-budget allowed), which is all --batch and --serve jobs can be */
+bool plainRender(Options *options);
+
+/* One worker's tiles: the owner takes from the front, thieves from the back */
+class TileQueue {
+public:
+	bool Pop(int *tile);
+	bool Steal(int *tile);
+	int Size();
+	deque<int> tiles;
+	mutex lock;
+};
+
+/* Work stealing over tile indices. Tiles are dealt round robin in spiral order, so every */
+/* worker starts near the center; a worker that runs dry steals the outermost tile of the */
+/* worker with the most left, which keeps the expensive tiles from landing on one thread */
+class TileScheduler {
+public:
+	TileScheduler(int tiles, int workers);
+	bool Next(int worker, int *tile);
+	vector<TileQueue> queues;
+	atomic<int> stolen;
+};
+
+/* --threads, or one per core */
+int renderThreads(Options *options);
+
+/* Run work(worker, tile) over every tile on threads workers. With a perfLog each worker */
+/* adds its own sample for phase, numbered from 1 (0 is the main thread). Returns the rays */
+/* the workers traced, which their thread's raysTraced counted */
+long runTiles(vector<Tile> *tiles, TileScheduler *scheduler, int threads, PerfLog *perfLog, const char *phase,
+	function<void(int, Tile *)> work);
+
+/* The normal Whitted render of every pixel into img, spread over the tile scheduler. With */
+/* a checkpoint, tiles it already holds are skipped and finished ones are snapshotted. With */
+/* --time-budget, tiles drop down quality levels as needed to finish in time (see budget.h) */
+void renderTiles(Scene *scene, Options *options, Image *img, PerfLog *perfLog, class Checkpoint *checkpoint);
@@ -0,0 +1,168 @@
+#include "sampler.h"
+#include "random.h"
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+const int SOBOL_DIMENSIONS = 2, SOBOL_BITS = 32, BLUE_NOISE_SIZE = 64;
+
+static uint32_t reverseBits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+	x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+	x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+	x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+	return x;
+}
+
+static uint32_t hashCombine(uint32_t seed, uint32_t value) {
+	return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+/* Integer finalizer, spreads nearby inputs over all 32 bits */
+static uint32_t hashInt(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+/* Owen scrambling by hashing (Laine and Karras, with Burley's constants): every bit is */
+/* flipped depending only on the bits above it, so stratification survives */
+static uint32_t owenScramble(uint32_t x, uint32_t seed) {
+	x = reverseBits(x);
+	x ^= x * 0x3d20adea;
+	x += seed;
+	x *= (seed >> 16) | 1;
+	x ^= x * 0x05526c56;
+	x ^= x * 0x53a22864;
+	return reverseBits(x);
+}
+
+/* Direction numbers for the first two Sobol dimensions: van der Corput, and the one from */
+/* the polynomial x + 1. Together they're a (0, 2) sequence, so every power of two prefix */
+/* is stratified in every 2D elementary interval; higher Sobol dimensions aren't, and */
+/* their poor pair projections cost more than they save */
+class SobolTable {
+public:
+	SobolTable();
+	uint32_t directions[SOBOL_DIMENSIONS][SOBOL_BITS];
+};
+
+SobolTable::SobolTable() {
+	directions[1][0] = 1u << 31;
+
+	for (int k = 0; k < SOBOL_BITS; k++) {
+		directions[0][k] = 1u << (31 - k);
+		if (k)
+			directions[1][k] = directions[1][k - 1] ^ (directions[1][k - 1] >> 1);
+	}
+}
+
+static SobolTable sobolTable;
+
+float sobolOwen(uint32_t index, int dimension, uint32_t seed) {
+	int group = dimension / SOBOL_DIMENSIONS, d = dimension % SOBOL_DIMENSIONS;
+	uint32_t groupSeed = hashInt(hashCombine(seed, group)), result = 0;
+
+	/* Shuffle the order of points, then scramble the chosen point's coordinate. The shuffled */
+	/* index has random bits, so the matrix product is done without branches */
+	index = owenScramble(index, groupSeed);
+	if (d == 0)
+		result = reverseBits(index);
+	else
+		for (int k = 0; k < SOBOL_BITS; k++)
+			result ^= sobolTable.directions[d][k] & (0u - ((index >> k) & 1));
+
+	result = owenScramble(result, hashInt(hashCombine(groupSeed, d)));
+	return (result >> 8) / (float) (1 << 24);
+}
+
+/* Ranks of a blue noise dither mask, built by placing each point in the largest void */
+/* left by the ones before it (the second half of Ulichney's void and cluster method). */
+/* Energy is a Gaussian of every placed point, wrapped so the mask tiles */
+class BlueNoiseMask {
+public:
+	BlueNoiseMask();
+	float values[BLUE_NOISE_SIZE * BLUE_NOISE_SIZE];
+};
+
+BlueNoiseMask::BlueNoiseMask() {
+	const int size = BLUE_NOISE_SIZE, pixels = size * size, reach = 6;
+	vector<double> energy(pixels, 0);
+	vector<char> placed(pixels, false);
+	double kernel[2 * reach + 1][2 * reach + 1];
+
+	for (int dx = -reach; dx <= reach; dx++)
+		for (int dy = -reach; dy <= reach; dy++)
+			kernel[dx + reach][dy + reach] = exp(-(dx * dx + dy * dy) / (2 * 1.5 * 1.5));
+
+	for (int rank = 0; rank < pixels; rank++) {
+		int best = -1;
+
+		for (int p = 0; p < pixels; p++)
+			if (!placed[p] && (best < 0 || energy[p] < energy[best]))
+				best = p;
+
+		placed[best] = true;
+		values[best] = (rank + 0.5f) / pixels;
+
+		for (int dx = -reach; dx <= reach; dx++) {
+			for (int dy = -reach; dy <= reach; dy++) {
+				int x = (best % size + dx + size) % size, y = (best / size + dy + size) % size;
+				energy[y * size + x] += kernel[dx + reach][dy + reach];
+			}
+		}
+	}
+}
+
+float blueNoise(int i, int j, int dimension) {
+	/* Built on first use; initialising a local static is thread safe */
+	static BlueNoiseMask mask;
+
+	/* Each dimension reads the mask at an offset along the R2 sequence, so they don't correlate */
+	int x = (i + (int) (dimension * 0.7548776662 * BLUE_NOISE_SIZE)) % BLUE_NOISE_SIZE;
+	int y = (j + (int) (dimension * 0.5698402910 * BLUE_NOISE_SIZE)) % BLUE_NOISE_SIZE;
+	return mask.values[y * BLUE_NOISE_SIZE + x];
+}
+
+PixelSampler::PixelSampler(SamplerType type, int i, int j, int sample) {
+	this->type = type;
+	this->i = i;
+	this->j = j;
+	this->sample = sample;
+	seed = hashInt(hashCombine(hashInt(i), j));
+	random.Seed(i, j, sample);
+}
+
+/* Sobol gives every pixel its own scramble. Blue noise shares one scramble between */
+/* pixels and shifts it by the mask (Cranley-Patterson rotation), which leaves each */
+/* pixel's error as high as Sobol's but spreads it as high frequency, fine grained noise */
+float PixelSampler::Get(int dimension) {
+	if (type == SAMPLER_SOBOL)
+		return sobolOwen(sample, dimension, seed);
+
+	if (type == SAMPLER_BLUE_NOISE) {
+		float value = sobolOwen(sample, dimension, 0x5bd1e995) + blueNoise(i, j, dimension);
+		return value < 1 ? value : value - 1;
+	}
+
+	return random.Uniform();
+}
+
+bool parseSampler(const char *name, SamplerType *type) {
+	if (!strcmp(name, "random"))
+		*type = SAMPLER_RANDOM;
+	else if (!strcmp(name, "sobol"))
+		*type = SAMPLER_SOBOL;
+	else if (!strcmp(name, "blue"))
+		*type = SAMPLER_BLUE_NOISE;
+	else
+		return false;
+
+	return true;
+}
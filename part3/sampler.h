@@ -0,0 +1,31 @@
+#pragma once
+#include "random.h"
+#include <stdint.h>
+using namespace std;
+
+/* Where multi-sample modes get their numbers, see --sampler */
+enum SamplerType { SAMPLER_RANDOM, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE };
+
+/* Numbers for one sample of one pixel, addressed by dimension so a render is the same */
+/* whichever thread traces it. Callers give each decision a fixed dimension (see the */
+/* layouts in pathtrace.cpp and antialias.cpp) so the sequence lines up across samples */
+class PixelSampler {
+public:
+	PixelSampler(SamplerType type, int i, int j, int sample);
+	float Get(int dimension);
+	SamplerType type;
+	int i, j, sample;
+	uint32_t seed; /* per pixel Owen scrambling seed */
+	Random random; /* SAMPLER_RANDOM, drawn in call order */
+};
+
+/* Point index of the Owen scrambled Sobol sequence for seed, in [0, 1) */
+/* Dimensions come in pairs (0 and 1, 2 and 3, ...), each an independently shuffled and */
+/* scrambled copy of the 2D Sobol sequence, so put a decision's two numbers in one pair */
+float sobolOwen(uint32_t index, int dimension, uint32_t seed);
+
+/* Value in [0, 1) from a 64 x 64 tiling blue noise mask, shifted per dimension */
+float blueNoise(int i, int j, int dimension);
+
+/* "random", "sobol" or "blue", return false on anything else */
+bool parseSampler(const char *name, SamplerType *type);
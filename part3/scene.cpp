@@ -0,0 +1,73 @@
+#include "scene.h"
+#include "objs.h"
+#include "lights.h"
+#include "options.h"
+#include "random.h"
+#include "gbuffer.h"
+#include <vector>
+using namespace std;
+
+Scene::Scene() {
+	camera = Camera();
+	gbuffer = NULL;
+}
+
+Scene::~Scene() {
+	for (int g = 0; g < allGeometry.size(); g++)
+		delete allGeometry[g];
+
+	for (int l = 0; l < lights.size(); l++)
+		delete lights[l];
+}
+
+/* Once parsing is done, build the light hierarchy and point geometry back at the scene */
+void Scene::Setup(Options *options) {
+	lightTree.Build(&lights, options->lightCutoff);
+	lightTree.samples = options->lightSamples;
+	bounceLimits.maxDepth = options->maxDepth;
+	bounceLimits.minThroughput = options->minThroughput;
+
+	for (int g = 0; g < allGeometry.size(); g++) {
+		allGeometry[g]->lights = &lightTree;
+		allGeometry[g]->camera = &camera;
+		allGeometry[g]->bounceLimits = &bounceLimits;
+		allGeometry[g]->allGeometry = &allGeometry;
+		allGeometry[g]->index = g;
+	}
+}
+
+/* What the primary ray for pixel (i, j) hits, from the G-buffer when there is one */
+Geometry *Scene::PrimaryHit(int i, int j, Ray *ray, float *distance) {
+	if (gbuffer)
+		return gbuffer->Hit(this, i, j, distance);
+
+	raysTraced++;
+	return closestHit(&allGeometry, i, j, ray, distance);
+}
+
+/* Trace pixel (i, j) and return its color averaged over samples, black on a miss. maxDepth */
+/* is bounceLimits.maxDepth, or less for a render cutting quality to fit a time budget */
+Pigment Scene::TracePixel(int i, int j, int width, int height, int samples, int maxDepth) {
+	Ray ray = Ray(i, j, width, height, &camera);
+	float distance = 10000;
+	Geometry *hitGeometry = PrimaryHit(i, j, &ray, &distance);
+
+	if (!hitGeometry)
+		return Pigment(0, 0, 0);
+
+	return ShadePixel(i, j, &ray, hitGeometry, distance, samples, maxDepth);
+}
+
+/* Shade a primary hit, following reflections; the hit is shared and each sample reseeds shading */
+/* so sampled lights and refraction choices differ between samples */
+Pigment Scene::ShadePixel(int i, int j, Ray *ray, Geometry *hit, float distance, int samples, int maxDepth) {
+	Pigment result = Pigment(0, 0, 0);
+
+	for (int s = 0; s < samples; s++) {
+		shadingRandom.Seed(i, j, s);
+		result += hit->Reflect(i, j, distance, ray, NULL, maxDepth);
+	}
+
+	result *= 1.0 / samples;
+	return result;
+}
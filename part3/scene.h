@@ -0,0 +1,25 @@
+#pragma once
+#include "objs.h"
+#include "lights.h"
+#include "options.h"
+#include <vector>
+using namespace std;
+
+/* Everything parsed from one .pov file; owns its lights and geometry. Shading only reads */
+/* it, so every render thread traces the same Scene */
+class Scene {
+public:
+	Scene();
+	~Scene();
+	void Setup(Options *options);
+	Geometry *PrimaryHit(int i, int j, Ray *ray, float *distance);
+	Pigment TracePixel(int i, int j, int width, int height, int samples, int maxDepth);
+	Pigment ShadePixel(int i, int j, Ray *ray, Geometry *hit, float distance, int samples, int maxDepth);
+	Camera camera;
+	BounceLimits bounceLimits;
+	vector<Light *> lights;
+	LightTree lightTree;
+	vector<Geometry *> allGeometry;
+	MaterialTable materials;
+	class GBuffer *gbuffer; /* cached primary hits, NULL to trace them */
+};
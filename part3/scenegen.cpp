@@ -0,0 +1,224 @@
+/* Synthetic scene generator for scaling studies */
+/* Writes .pov files in the line layout parse() expects, reproducibly from a seed */
+
+#include "random.h"
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <cmath>
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Generator settings, all counts default to an empty scene */
+class GenOptions {
+public:
+	GenOptions();
+	uint64_t seed;
+	int spheres, triangles, mesh, planes, materials, lights;
+	float reflect, reflectFraction, extent, fade;
+	string output;
+};
+
+GenOptions::GenOptions() {
+	seed = 1;
+	spheres = triangles = mesh = planes = materials = 0;
+	lights = 1;
+	fade = 0;
+	reflect = 0.5;
+	reflectFraction = 0;
+	extent = 10;
+	output = "";
+}
+
+static void printUsage() {
+	cout << "Usage: ./scenegen [options] > scene.pov" << endl;
+	cout << "  --seed n             random seed (default 1)" << endl;
+	cout << "  --spheres n          number of random spheres" << endl;
+	cout << "  --triangles n        number of triangles in a random soup" << endl;
+	cout << "  --mesh n             about n triangles tessellating a height field" << endl;
+	cout << "  --planes m           number of planes, the first one is a floor" << endl;
+	cout << "  --lights k           number of light sources (default 1)" << endl;
+	cout << "  --fade d             give extra lights fade_distance d, fade_power 2 (default 0, no fade)" << endl;
+	cout << "  --materials k        draw materials from a palette of k (default 0, one per object)" << endl;
+	cout << "  --reflect r          reflection value for reflective objects (default 0.5)" << endl;
+	cout << "  --reflect-fraction f fraction of objects that are reflective (default 0)" << endl;
+	cout << "  --extent e           objects are placed in a cube of half width e (default 10)" << endl;
+	cout << "  --output file        write to file instead of stdout" << endl;
+}
+
+/* Pigment and finish lines for one object */
+static string makeMaterial(Random *random, GenOptions *options) {
+	char line[200];
+	float reflect = random->Uniform() < options->reflectFraction ? options->reflect : 0;
+	int length;
+
+	length = sprintf(line, "  pigment {color rgb <%.3f, %.3f, %.3f>}\n", random->Range(0.1, 1), random->Range(0.1, 1), random->Range(0.1, 1));
+	length += sprintf(line + length, "  finish {ambient 0.2 diffuse 0.6 specular %.2f roughness %.3f", random->Range(0, 0.6), random->Range(0.01, 0.1));
+	if (reflect)
+		length += sprintf(line + length, " reflection %.3f", reflect);
+	sprintf(line + length, "}\n");
+
+	return line;
+}
+
+/* With a palette, objects share its entries; otherwise every object gets its own material */
+static void writeMaterial(FILE *out, Random *random, GenOptions *options, vector<string> *palette) {
+	if (palette->size())
+		fputs(palette->at((int) (random->Uniform() * palette->size())).c_str(), out);
+	else
+		fputs(makeMaterial(random, options).c_str(), out);
+}
+
+static void writeTriangle(FILE *out, float v[3][3], Random *random, GenOptions *options, vector<string> *palette) {
+	fprintf(out, "triangle {\n");
+	for (int k = 0; k < 3; k++)
+		fprintf(out, "  <%.4f, %.4f, %.4f>%s\n", v[k][0], v[k][1], v[k][2], k < 2 ? "," : "");
+	writeMaterial(out, random, options, palette);
+	fprintf(out, "}\n\n");
+}
+
+/* Height field z = f(x, y) facing the camera, split into two triangles per grid cell */
+/* The whole surface shares one material, like a tessellated model would */
+static void writeMesh(FILE *out, Random *random, GenOptions *options) {
+	vector<string> palette(1, makeMaterial(random, options));
+	int cells = (int) ceil(sqrt(options->mesh / 2.0));
+	float size = 2 * options->extent / cells, phase = random->Range(0, 6.28);
+
+	for (int row = 0; row < cells; row++) {
+		for (int col = 0; col < cells; col++) {
+			float corner[4][3];
+
+			for (int k = 0; k < 4; k++) {
+				float x = -options->extent + (col + k % 2) * size;
+				float y = -options->extent + (row + k / 2) * size;
+				corner[k][0] = x;
+				corner[k][1] = y;
+				corner[k][2] = -options->extent + sin(x * 0.5 + phase) * cos(y * 0.5) * 2;
+			}
+
+			float first[3][3] = {{corner[0][0], corner[0][1], corner[0][2]}, {corner[1][0], corner[1][1], corner[1][2]}, {corner[3][0], corner[3][1], corner[3][2]}};
+			float second[3][3] = {{corner[0][0], corner[0][1], corner[0][2]}, {corner[3][0], corner[3][1], corner[3][2]}, {corner[2][0], corner[2][1], corner[2][2]}};
+			writeTriangle(out, first, random, options, &palette);
+			writeTriangle(out, second, random, options, &palette);
+		}
+	}
+}
+
+static void writeScene(FILE *out, GenOptions *options) {
+	Random random = Random(options->seed);
+	vector<string> palette;
+	float e = options->extent;
+
+	for (int m = 0; m < options->materials; m++)
+		palette.push_back(makeMaterial(&random, options));
+
+	fprintf(out, "// scenegen --seed %llu --spheres %d --triangles %d --mesh %d --planes %d\n\n",
+		(unsigned long long) options->seed, options->spheres, options->triangles, options->mesh, options->planes);
+
+	fprintf(out, "camera {\n");
+	fprintf(out, "  location  <0, 0, %.4f>\n", 3 * e);
+	fprintf(out, "  up        <0,  1,  0>\n");
+	fprintf(out, "  right     <1.33333, 0,  0>\n");
+	fprintf(out, "  look_at   <0, 0, 0>\n");
+	fprintf(out, "}\n\n");
+
+	fprintf(out, "light_source {<%.4f, %.4f, %.4f> color rgb <1.5, 1.5, 1.5>}\n\n", -10 * e, 10 * e, 10 * e);
+
+	/* Past the first (a distant key light), lights are scattered through the scene */
+	for (int l = 1; l < options->lights; l++) {
+		fprintf(out, "light_source {<%.2f, %.2f, %.2f> color rgb <%.2f, %.2f, %.2f>", random.Range(-e, e), random.Range(-e, e),
+			random.Range(-e, e), random.Range(0.2, 1), random.Range(0.2, 1), random.Range(0.2, 1));
+		if (options->fade)
+			fprintf(out, "\n  fade_distance %.2f fade_power 2\n", options->fade);
+		fprintf(out, "}\n");
+	}
+	fprintf(out, "\n");
+
+	for (int p = 0; p < options->planes; p++) {
+		/* First plane is a floor under everything, the rest are walls behind it tilted at random */
+		float nx = p ? random.Range(-0.5, 0.5) : 0, ny = p ? random.Range(-0.2, 0.2) : 1, nz = p ? 1 : 0;
+		float length = sqrt(nx * nx + ny * ny + nz * nz);
+
+		fprintf(out, "plane {<%.4f, %.4f, %.4f>, %.4f\n", nx / length, ny / length, nz / length, p ? -2 * e - p : -1.2 * e);
+		writeMaterial(out, &random, options, &palette);
+		fprintf(out, "}\n\n");
+	}
+
+	for (int s = 0; s < options->spheres; s++) {
+		fprintf(out, "sphere { <%.4f, %.4f, %.4f>, %.4f\n", random.Range(-e, e), random.Range(-e, e), random.Range(-e, e),
+			random.Range(0.02, 0.15) * e);
+		writeMaterial(out, &random, options, &palette);
+		fprintf(out, "}\n\n");
+	}
+
+	for (int t = 0; t < options->triangles; t++) {
+		float center[3] = {random.Range(-e, e), random.Range(-e, e), random.Range(-e, e)}, v[3][3];
+		float size = random.Range(0.05, 0.3) * e;
+
+		for (int k = 0; k < 3; k++)
+			for (int axis = 0; axis < 3; axis++)
+				v[k][axis] = center[axis] + random.Range(-size, size);
+
+		writeTriangle(out, v, &random, options, &palette);
+	}
+
+	if (options->mesh)
+		writeMesh(out, &random, options);
+}
+
+int main(int argc, char *argv[]) {
+	GenOptions options;
+	FILE *out = stdout;
+
+	for (int a = 1; a < argc; a++) {
+		if (a + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+
+		if (!strcmp(argv[a], "--seed"))
+			options.seed = strtoull(argv[++a], NULL, 10);
+		else if (!strcmp(argv[a], "--spheres"))
+			options.spheres = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--triangles"))
+			options.triangles = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--mesh"))
+			options.mesh = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--planes"))
+			options.planes = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--lights"))
+			options.lights = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--fade"))
+			options.fade = strtof(argv[++a], NULL);
+		else if (!strcmp(argv[a], "--materials"))
+			options.materials = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--reflect"))
+			options.reflect = strtof(argv[++a], NULL);
+		else if (!strcmp(argv[a], "--reflect-fraction"))
+			options.reflectFraction = strtof(argv[++a], NULL);
+		else if (!strcmp(argv[a], "--extent"))
+			options.extent = strtof(argv[++a], NULL);
+		else if (!strcmp(argv[a], "--output"))
+			options.output = argv[++a];
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (options.output.size() && !(out = fopen(options.output.c_str(), "w"))) {
+		perror("Error opening output file");
+		return 1;
+	}
+
+	writeScene(out, &options);
+
+	if (out != stdout)
+		fclose(out);
+
+	return 0;
+}
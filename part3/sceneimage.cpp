@@ -0,0 +1,253 @@
+#include "sceneimage.h"
+#include "scene.h"
+#include "objs.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+static const char magic[4] = {'R', 'T', 'S', 'I'};
+static const uint32_t VERSION = 1;
+
+enum FlatType { FLAT_SPHERE, FLAT_PLANE, FLAT_TRIANGLE };
+
+class FlatHeader {
+public:
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	Camera camera;
+	uint32_t lights, materials, geometry;
+	uint64_t lightOffset, materialOffset, geometryOffset;
+};
+
+class FlatLight {
+public:
+	Point center;
+	Pigment pigment;
+	float fadeDistance, fadePower;
+};
+
+class FlatMaterial {
+public:
+	Pigment pigment;
+	Finish finish;
+};
+
+/* Everything any shape keeps between hits, so loading needs no arithmetic that could round */
+/* differently from parsing: sphere center / plane point in points[0], triangle vertices in */
+/* points, plane normal in vectors[0], triangle AB and AC in vectors[1] and [2] */
+class FlatGeometry {
+public:
+	int32_t type, material, line;
+	Point points[3];
+	Vector vectors[3];
+	float scalar; /* sphere radius, plane distance */
+};
+
+/* FNV-1a, as for the G-buffer key */
+static uint64_t textKey(string *text) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t b = 0; b < text->size(); b++) {
+		hash ^= (unsigned char) (*text)[b];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/* True when count records of size at offset lie inside the file */
+static bool fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize) {
+	return offset <= fileSize && count <= (fileSize - offset) / size;
+}
+
+/* True when every object has a known type and one of the image's materials */
+static bool validGeometry(const FlatHeader *header, const FlatGeometry *geometry) {
+	for (int g = 0; g < header->geometry; g++) {
+		if (geometry[g].type < FLAT_SPHERE || geometry[g].type > FLAT_TRIANGLE || geometry[g].material < 0 ||
+			(uint32_t) geometry[g].material >= header->materials)
+			return false;
+	}
+
+	return true;
+}
+
+/* Geometry is built from the mapping rather than used in place, since the objects need their */
+/* vtables; the mapping replaces parsing, and is dropped once the scene is built */
+bool loadSceneImage(const char *fileName, string *text, Scene *scene) {
+	int fd = open(fileName, O_RDONLY);
+	struct stat info;
+	void *mapped;
+
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &info) || info.st_size < sizeof(FlatHeader) ||
+		(mapped = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	const char *base = (const char *) mapped;
+	const FlatHeader *header = (const FlatHeader *) base;
+
+	if (memcmp(header->magic, magic, 4) || header->version != VERSION || header->key != textKey(text) ||
+		!fits(header->lightOffset, header->lights, sizeof(FlatLight), info.st_size) ||
+		!fits(header->materialOffset, header->materials, sizeof(FlatMaterial), info.st_size) ||
+		!fits(header->geometryOffset, header->geometry, sizeof(FlatGeometry), info.st_size)) {
+		munmap(mapped, info.st_size);
+		return false;
+	}
+
+	const FlatLight *lights = (const FlatLight *) (base + header->lightOffset);
+	const FlatMaterial *materials = (const FlatMaterial *) (base + header->materialOffset);
+	const FlatGeometry *geometry = (const FlatGeometry *) (base + header->geometryOffset);
+
+	if (!validGeometry(header, geometry)) {
+		munmap(mapped, info.st_size);
+		return false;
+	}
+
+	scene->camera = header->camera;
+
+	for (int l = 0; l < header->lights; l++) {
+		Light *light = new Light(lights[l].center, lights[l].pigment);
+
+		light->fadeDistance = lights[l].fadeDistance;
+		light->fadePower = lights[l].fadePower;
+		scene->lights.push_back(light);
+	}
+
+	/* Interned in file order, so every index comes back the same */
+	for (int m = 0; m < header->materials; m++) {
+		Pigment pigment = materials[m].pigment;
+		Finish finish = materials[m].finish;
+
+		scene->materials.Intern(&pigment, &finish);
+	}
+
+	for (int g = 0; g < header->geometry; g++) {
+		const FlatGeometry *flat = &geometry[g];
+		Geometry *object;
+
+		if (flat->type == FLAT_SPHERE) {
+			Sphere *sphere = new Sphere();
+			sphere->center = flat->points[0];
+			sphere->radius = flat->scalar;
+			object = sphere;
+		}
+		else if (flat->type == FLAT_PLANE) {
+			Plane *plane = new Plane();
+			plane->normal = flat->vectors[0];
+			plane->distance = flat->scalar;
+			plane->point = flat->points[0];
+			object = plane;
+		}
+		else {
+			Triangle *triangle = new Triangle();
+			triangle->vertexA = flat->points[0];
+			triangle->vertexB = flat->points[1];
+			triangle->vertexC = flat->points[2];
+			triangle->AB = flat->vectors[1];
+			triangle->AC = flat->vectors[2];
+			object = triangle;
+		}
+
+		object->line = flat->line;
+		object->materials = &scene->materials;
+		object->material = flat->material;
+		scene->allGeometry.push_back(object);
+	}
+
+	munmap(mapped, info.st_size);
+	return true;
+}
+
+bool saveSceneImage(const char *fileName, string *text, Scene *scene) {
+	vector<FlatLight> lights(scene->lights.size());
+	vector<FlatMaterial> materials(scene->materials.materials.size());
+	vector<FlatGeometry> geometry(scene->allGeometry.size(), FlatGeometry()); /* zeroed, padding too */
+	FlatHeader header = FlatHeader(); /* value initialized, so padding is written as zeros */
+	char temporary[512];
+	FILE *out;
+	bool ok;
+
+	memcpy(header.magic, magic, 4);
+	header.version = VERSION;
+	header.key = textKey(text);
+	header.camera = scene->camera;
+	header.lights = lights.size();
+	header.materials = materials.size();
+	header.geometry = geometry.size();
+	header.lightOffset = sizeof(header);
+	header.materialOffset = header.lightOffset + lights.size() * sizeof(FlatLight);
+	header.geometryOffset = header.materialOffset + materials.size() * sizeof(FlatMaterial);
+
+	for (int l = 0; l < lights.size(); l++) {
+		lights[l].center = scene->lights[l]->center;
+		lights[l].pigment = scene->lights[l]->pigment;
+		lights[l].fadeDistance = scene->lights[l]->fadeDistance;
+		lights[l].fadePower = scene->lights[l]->fadePower;
+	}
+
+	for (int m = 0; m < materials.size(); m++) {
+		materials[m].pigment = scene->materials.materials[m].pigment;
+		materials[m].finish = scene->materials.materials[m].finish;
+	}
+
+	for (int g = 0; g < geometry.size(); g++) {
+		Geometry *object = scene->allGeometry[g];
+		FlatGeometry *flat = &geometry[g];
+		Sphere *sphere;
+		Plane *plane;
+		Triangle *triangle;
+
+		flat->material = object->material;
+		flat->line = object->line;
+
+		if ((sphere = dynamic_cast<Sphere *>(object))) {
+			flat->type = FLAT_SPHERE;
+			flat->points[0] = sphere->center;
+			flat->scalar = sphere->radius;
+		}
+		else if ((plane = dynamic_cast<Plane *>(object))) {
+			flat->type = FLAT_PLANE;
+			flat->points[0] = plane->point;
+			flat->vectors[0] = plane->normal;
+			flat->scalar = plane->distance;
+		}
+		else if ((triangle = dynamic_cast<Triangle *>(object))) {
+			flat->type = FLAT_TRIANGLE;
+			flat->points[0] = triangle->vertexA;
+			flat->points[1] = triangle->vertexB;
+			flat->points[2] = triangle->vertexC;
+			flat->vectors[1] = triangle->AB;
+			flat->vectors[2] = triangle->AC;
+		}
+	}
+
+	snprintf(temporary, sizeof(temporary), "%s.%d", fileName, (int) getpid());
+	if (!(out = fopen(temporary, "wb")))
+		return false;
+
+	ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+		fwrite(lights.data(), sizeof(FlatLight), lights.size(), out) == lights.size() &&
+		fwrite(materials.data(), sizeof(FlatMaterial), materials.size(), out) == materials.size() &&
+		fwrite(geometry.data(), sizeof(FlatGeometry), geometry.size(), out) == geometry.size();
+	ok = !fclose(out) && ok;
+
+	if (!ok || rename(temporary, fileName)) {
+		unlink(temporary);
+		return false;
+	}
+
+	return true;
+}
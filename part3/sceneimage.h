@@ -0,0 +1,19 @@
+#pragma once
+#include "scene.h"
+#include <stdint.h>
+#include <string>
+using namespace std;
+
+/* A parsed scene laid out flat for mmap: a header, then lights, materials and geometry as */
+/* fixed size records found by offset from the start of the file. Nothing in it is a */
+/* pointer, so any process can map it wherever it lands. Loading copies the records into */
+/* the process's own objects, so what's saved is the parse; scene memory isn't shared and */
+/* still grows with the scene in every process. It holds what parse() produces and nothing */
+/* Setup() derives from options, so the key is just a hash of the .pov text */
+
+/* Build scene from the image in fileName if its key matches text; false if it's missing or stale */
+bool loadSceneImage(const char *fileName, string *text, Scene *scene);
+
+/* Write scene (just parsed from text) to fileName, replacing it atomically so processes */
+/* mapping the old image never see half a file; false on a write error */
+bool saveSceneImage(const char *fileName, string *text, Scene *scene);
@@ -0,0 +1,303 @@
+#include "serve.h"
+#include "render.h"
+#include "parse.h"
+#include "scene.h"
+#include "options.h"
+#include "timer.h"
+#include "net.h"
+#include "Image.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <exception>
+#include <limits.h>
+#include <list>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+using namespace std;
+
+/* The wire format is net.h's.
+ *   client -> daemon: the client's absolute working directory, argument count, each argument,
+ *                     then the .pov text, or nothing to have the daemon read the scene file itself
+ *   daemon -> client: status, 0 for a written render, then everything the request printed */
+
+static const int REQUEST_SECONDS = 10; /* how long the daemon waits on a client that stopped sending or reading */
+static const int MAX_ARGUMENTS = 256; /* most arguments a request may carry */
+
+/* A parsed scene, ready for every render thread to trace */
+class CachedScene {
+public:
+	uint64_t key;
+	string text;
+	Scene scene;
+};
+
+/* FNV-1a, as for the G-buffer key */
+static void hashBytes(uint64_t *hash, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char *) data;
+
+	for (size_t b = 0; b < size; b++) {
+		*hash ^= bytes[b];
+		*hash *= 1099511628211ULL;
+	}
+}
+
+/* The .pov text and everything Scene::Setup takes from options */
+static uint64_t sceneKey(Options *options, string *text) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	hashBytes(&hash, text->data(), text->size());
+	hashBytes(&hash, &options->lightCutoff, sizeof(options->lightCutoff));
+	hashBytes(&hash, &options->lightSamples, sizeof(options->lightSamples));
+	hashBytes(&hash, &options->maxDepth, sizeof(options->maxDepth));
+	hashBytes(&hash, &options->minThroughput, sizeof(options->minThroughput));
+	return hash;
+}
+
+/* The cached scene for text, parsed (and the least recently used one dropped) if it isn't */
+/* there. Moves it to the front of cache; NULL if the text doesn't parse */
+static CachedScene *cachedScene(list<CachedScene *> *cache, int capacity, Options *options, string *text, bool *hit) {
+	uint64_t key = sceneKey(options, text);
+	CachedScene *entry = NULL;
+
+	for (list<CachedScene *>::iterator e = cache->begin(); e != cache->end(); e++) {
+		/* The text is compared too, a hash match alone could render the wrong scene */
+		if ((*e)->key == key && (*e)->text == *text) {
+			entry = *e;
+			cache->erase(e);
+			break;
+		}
+	}
+
+	*hit = entry != NULL;
+	if (!entry) {
+		entry = new CachedScene();
+		entry->key = key;
+		entry->text = *text;
+
+		if (sceneFromText(options, &entry->scene, text)) {
+			delete entry;
+			return NULL;
+		}
+
+		while (cache->size() >= capacity) {
+			delete cache->back();
+			cache->pop_back();
+		}
+	}
+
+	cache->push_front(entry);
+	return entry;
+}
+
+/* Paths in a request are the client's, relative ones are taken from where it was run. The */
+/* daemon never changes directory, one request can't move where the next one reads or writes */
+static void clientPath(string *directory, string *path) {
+	if (path->size() && (*path)[0] != '/')
+		*path = *directory + "/" + *path;
+}
+
+/* Read one request from fd and render it, printing to cout what goes back to the client. */
+/* Returns the status for the reply */
+static int serveRequest(int fd, Options *defaults, list<CachedScene *> *cache) {
+	vector<string> arguments;
+	vector<char *> argv(1, (char *) "raytrace");
+	Options options;
+	string directory, text;
+	int32_t count;
+	bool hit;
+	char line[256];
+
+	bool received = receiveString(fd, &directory, MAX_ARGUMENT) && receiveAll(fd, &count, sizeof(count)) &&
+		count >= 0 && count <= MAX_ARGUMENTS;
+	for (int a = 0; received && a < count; a++) {
+		arguments.push_back("");
+		received = receiveString(fd, &arguments.back(), MAX_ARGUMENT);
+	}
+
+	if (!received || !receiveString(fd, &text, MAX_TEXT)) {
+		cout << "Error. Request cut short, too large, or too slow." << endl;
+		return 1;
+	}
+
+	if (directory.empty() || directory[0] != '/') {
+		cout << "Error. Request needs the client's absolute working directory." << endl;
+		return 1;
+	}
+
+	/* Everything on the daemon's command line but --serve and --scene-cache, then the request's */
+	for (int a = 0; a < defaults->arguments.size(); a++) {
+		if (defaults->arguments[a] == "--serve" || defaults->arguments[a] == "--scene-cache")
+			a++;
+		else
+			argv.push_back((char *) defaults->arguments[a].c_str());
+	}
+	for (int a = 0; a < arguments.size(); a++)
+		argv.push_back((char *) arguments[a].c_str());
+
+	if (parseOptions(argv.size(), &argv[0], &options))
+		return 1;
+
+	if (!plainRender(&options) || options.sceneImage.size()) {
+		cout << "Error. --serve renders default frames only, written to --output." << endl;
+		return 1;
+	}
+
+	clientPath(&directory, &options.fileName);
+	clientPath(&directory, &options.output);
+	clientPath(&directory, &options.composite);
+
+	if (!text.size()) {
+		ifstream povray(options.fileName.c_str(), ios::binary);
+		stringstream contents;
+
+		if (!povray.is_open()) {
+			cout << "Error opening file." << endl;
+			return 1;
+		}
+
+		contents << povray.rdbuf();
+		text = contents.str();
+	}
+
+	Timer timer;
+	CachedScene *entry = cachedScene(cache, defaults->sceneCache, &options, &text, &hit);
+	double loadMs = timer.Milliseconds();
+
+	if (!entry)
+		return 1;
+
+	Image img(options.width, options.height);
+
+	renderTiles(&entry->scene, &options, &img, NULL, NULL);
+	if (writeRender(&options, &img))
+		return 1;
+
+	snprintf(line, sizeof(line), "Rendered %dx%d in %.1fms, scene %s %.1fms.", options.width, options.height, timer.Milliseconds(),
+		hit ? "cached, ready in" : "parsed in", loadMs);
+	cout << line << endl;
+	return 0;
+}
+
+int runServer(Options *options) {
+	list<CachedScene *> cache;
+
+	/* Only the daemon's user may connect, requests write files as that user */
+	if (!localSocket(options->serve.c_str())) {
+		cout << "Error. --serve takes a Unix socket path, not host:port." << endl;
+		return 1;
+	}
+
+	mode_t mask = umask(0077);
+	int listener = listenOn(options->serve.c_str());
+	umask(mask);
+
+	if (listener < 0)
+		return 1;
+	chmod(options->serve.c_str(), 0600);
+
+	printf("Serving renders on %s.\n", options->serve.c_str());
+	fflush(stdout);
+
+	while (true) {
+		int fd = accept(listener, NULL, NULL);
+		ostringstream printed;
+		string reply;
+
+		if (fd < 0 && errno == EINTR)
+			continue;
+		if (fd < 0) {
+			cout << "Error. Waiting for requests failed: " << strerror(errno) << endl;
+			break;
+		}
+
+		/* Requests are served one at a time, so a client that stalls is dropped after */
+		/* REQUEST_SECONDS rather than holding up the ones behind it */
+		receiveTimeout(fd, REQUEST_SECONDS);
+		sendTimeout(fd, REQUEST_SECONDS);
+
+		/* cout is the request's while it runs, and a request that throws fails alone */
+		streambuf *console = cout.rdbuf(printed.rdbuf());
+		int status;
+		try {
+			status = serveRequest(fd, options, &cache);
+		}
+		catch (exception &e) {
+			cout << "Error. Request failed: " << e.what() << endl;
+			status = 1;
+		}
+		cout.rdbuf(console);
+
+		appendInt(&reply, status);
+		appendString(&reply, printed.str());
+		sendAll(fd, reply.data(), reply.size());
+		close(fd);
+
+		cout << printed.str() << flush;
+	}
+
+	for (list<CachedScene *>::iterator e = cache.begin(); e != cache.end(); e++)
+		delete *e;
+	close(listener);
+	return 1;
+}
+
+int renderOnServer(Options *options) {
+	char directory[PATH_MAX];
+	string request, text, printed;
+	int32_t status;
+	int fd;
+
+	if (!getcwd(directory, sizeof(directory))) {
+		cout << "Error. Can't find the working directory: " << strerror(errno) << endl;
+		return 1;
+	}
+
+	if (options->sendScene) {
+		ifstream povray(options->fileName.c_str(), ios::binary);
+		stringstream contents;
+
+		if (!povray.is_open()) {
+			cout << "Error opening file." << endl;
+			return 1;
+		}
+
+		contents << povray.rdbuf();
+		text = contents.str();
+	}
+
+	/* Everything but the flags that brought the request here */
+	vector<string> arguments;
+	for (int a = 0; a < options->arguments.size(); a++) {
+		if (options->arguments[a] == "--server")
+			a++;
+		else if (options->arguments[a] != "--send-scene")
+			arguments.push_back(options->arguments[a]);
+	}
+
+	appendString(&request, directory);
+	appendInt(&request, arguments.size());
+	for (int a = 0; a < arguments.size(); a++)
+		appendString(&request, arguments[a]);
+	appendString(&request, text);
+
+	if ((fd = connectTo(options->server.c_str(), "render server", 0)) < 0)
+		return 1;
+
+	if (!sendAll(fd, request.data(), request.size()) || !receiveAll(fd, &status, sizeof(status)) || !receiveString(fd, &printed, MAX_TEXT)) {
+		cout << "Error. Render server " << options->server << " closed before answering." << endl;
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+	cout << printed;
+	return status ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "options.h"
+using namespace std;
+
+/* --serve: render requests from --server clients one at a time, on all the threads, until */
+/* killed. The daemon's own flags are defaults for every request. Parsed scenes (with their */
+/* light trees) are kept in a least recently used cache keyed by the */
+/* .pov text and the settings that shape them, so a repeat render starts tracing at once. */
+/* address must be a Unix socket path, created readable by our user only. A request that is */
+/* malformed, stalls or throws gets an error reply and the daemon carries on. Returns 1 if */
+/* address can't be listened on */
+int runServer(Options *options);
+
+/* --server: send this render to the daemon at options->server, which writes the output, */
+/* and print what it reports. Returns 1 if the daemon can't be reached or the render failed */
+int renderOnServer(Options *options);
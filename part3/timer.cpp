@@ -0,0 +1,20 @@
+#include "timer.h"
+#include <chrono>
+using namespace std;
+
+Timer::Timer() {
+	Reset();
+}
+
+void Timer::Reset() {
+	start = chrono::steady_clock::now();
+}
+
+/* Milliseconds since construction or last Reset */
+double Timer::Milliseconds() {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+double Timer::Seconds() {
+	return Milliseconds() / 1000.0;
+}
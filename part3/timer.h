@@ -0,0 +1,13 @@
+#pragma once
+#include <chrono>
+using namespace std;
+
+/* Wall clock stopwatch, started on construction */
+class Timer {
+public:
+	Timer();
+	void Reset();
+	double Milliseconds();
+	double Seconds();
+	chrono::steady_clock::time_point start;
+};